@@ -0,0 +1,146 @@
+#include "sql_batch_writer.h"
+
+sqlBatchWriter::sqlBatchWriter() : connPool(NULL), threadNumber(0), batchMax(SQL_BATCH_MAX),
+                                   flushMs(SQL_BATCH_FLUSH_MS), maxTask(0), stopping(false), closeLog(0)
+{
+}
+
+// 有线程等在条件变量上时销毁会一直阻塞，先让写入线程退出
+sqlBatchWriter::~sqlBatchWriter()
+{
+    queueLocker.lock();
+    stopping = true;
+    queueLocker.unlock();
+    queueCond.broadcast();
+    for (size_t i = 0; i < threads.size(); i ++ ) pthread_join(threads[i], NULL);
+}
+
+sqlBatchWriter* sqlBatchWriter::GetInstance()
+{
+    static sqlBatchWriter writer;
+    return &writer;
+}
+
+bool sqlBatchWriter::init(connectionPool* _connPool, int _closeLog, int _threadNumber,
+                          int _batchMax, int _flushMs, int _maxTask)
+{
+    if (!_connPool || _threadNumber <= 0 || _batchMax <= 0 || _maxTask <= 0) return false;
+    connPool = _connPool;
+    closeLog = _closeLog;
+    batchMax = _batchMax;
+    flushMs = _flushMs > 0 ? _flushMs : 0;
+    maxTask = _maxTask;
+
+    for (int i = 0; i < _threadNumber; i ++ )
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker, this) != 0) break;
+        threads.push_back(tid);
+        threadNumber ++ ;
+    }
+    return threadNumber > 0;
+}
+
+bool sqlBatchWriter::submit(sqlTask* task)
+{
+    if (threadNumber == 0) return false;
+
+    queueLocker.lock();
+    if ((int)taskQueue.size() >= maxTask)
+    {
+        queueLocker.unlock();
+        return false;
+    }
+    taskQueue.push_back(task);
+    queueLocker.unlock();
+    queueCond.signal();
+    return true;
+}
+
+void* sqlBatchWriter::worker(void* arg)
+{
+    sqlBatchWriter* writer = (sqlBatchWriter*)arg;
+    mysql_thread_init();
+    writer->run();
+    mysql_thread_end();
+    return writer;
+}
+
+void sqlBatchWriter::run()
+{
+    vector<sqlTask*> batch;
+    batch.reserve(batchMax);
+
+    queueLocker.lock();
+    while (!stopping)
+    {
+        bool idle = taskQueue.empty();
+        while (taskQueue.empty() && !stopping) queueCond.wait(queueLocker.get());
+        if (stopping) break;
+
+        // 空闲时被唤醒，多等一会儿让同时到达的注册凑成一批
+        if (idle && flushMs > 0 && (int)taskQueue.size() < batchMax)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)flushMs * 1000000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            while ((int)taskQueue.size() < batchMax && !stopping)
+            {
+                if (!queueCond.timewait(queueLocker.get(), deadline)) break;
+            }
+        }
+
+        while (!taskQueue.empty() && (int)batch.size() < batchMax)
+        {
+            batch.push_back(taskQueue.front());
+            taskQueue.pop_front();
+        }
+        queueLocker.unlock();
+
+        write(batch);
+        for (size_t i = 0; i < batch.size(); i ++ ) batch[i]->done(batch[i]);
+        batch.clear();
+
+        queueLocker.lock();
+    }
+    queueLocker.unlock();
+}
+
+// 执行一批注册，填好每个任务的result
+void sqlBatchWriter::write(vector<sqlTask*>& batch)
+{
+    int n = batch.size();
+    MYSQL* mysql = NULL;
+    connectionRAII mysqlConn(&mysql, connPool, SQL_WAIT_MS);
+    if (mysql == NULL)
+    {
+        for (int i = 0; i < n; i ++ ) batch[i]->result = -1;
+        return;
+    }
+
+    int err = insertRows(mysqlConn, &batch[0], n);
+    if (err == ER_DUP_ENTRY && n > 1)
+    {
+        // 多行INSERT是一条语句，失败时整体回滚，逐行重试找出重复的那几个
+        for (int i = 0; i < n; i ++ ) batch[i]->result = insertRows(mysqlConn, &batch[i], 1);
+        return;
+    }
+    for (int i = 0; i < n; i ++ ) batch[i]->result = err;
+}
+
+// 用连接上缓存的多行INSERT语句写入，返回0或错误码，连接断开时返回-1
+int sqlBatchWriter::insertRows(connectionRAII& mysqlConn, sqlTask** tasks, int n)
+{
+    vector<string> params(2 * n);
+    for (int i = 0; i < n; i ++ )
+    {
+        params[2 * i] = tasks[i]->params[0];
+        params[2 * i + 1] = tasks[i]->params[1];
+    }
+
+    int err = mysqlConn.Execute(STMT_USER_INSERT, &params[0], 2 * n, n);
+    if (err != 0 && err != ER_DUP_ENTRY) LOG_ERROR("register batch of %d failed: %d", n, err);
+    return err;
+}
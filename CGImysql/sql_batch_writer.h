@@ -0,0 +1,56 @@
+#pragma once
+
+
+#include <list>
+#include <vector>
+#include <string>
+#include <time.h>
+#include <pthread.h>
+#include <mysql/mysql.h>
+#include "../lock/locker.h"
+#include "../log/log.h"
+#include "sql_connection.h"
+#include "sql_executor.h"
+
+using namespace std;
+
+const int SQL_BATCH_MAX = 64;           // 一条INSERT最多合并的行数
+const int SQL_BATCH_FLUSH_MS = 2;       // 队列空闲时第一条注册最多等多久就写入
+
+// 注册的组提交写入器
+// 排队的注册合并成一条多行INSERT，用连接上缓存的预处理语句绑定参数执行，一批只有一次往返和一次提交
+// 写入线程忙于上一批时到达的注册直接组成下一批，空闲时第一条注册最多等flushMs凑批
+// 整批因用户名重复失败时整条语句回滚，再逐行重试，每个注册拿到自己的结果
+class sqlBatchWriter
+{
+    private:
+        connectionPool*     connPool;
+        int                 threadNumber;
+        int                 batchMax;
+        int                 flushMs;
+        int                 maxTask;        // 队列中允许的最大任务数
+        list<sqlTask*>      taskQueue;
+        locker              queueLocker;
+        cond                queueCond;
+        bool                stopping;
+        vector<pthread_t>   threads;
+
+        sqlBatchWriter();
+        ~sqlBatchWriter();
+
+        static void*        worker(void* arg);
+        void                run();
+        void                write(vector<sqlTask*>& batch);
+        int                 insertRows(connectionRAII& mysqlConn, sqlTask** tasks, int n);
+
+    public:
+        int                 closeLog;
+
+        static sqlBatchWriter* GetInstance();
+
+        bool                init(connectionPool* _connPool, int _closeLog, int _threadNumber = 1,
+                                 int _batchMax = SQL_BATCH_MAX, int _flushMs = SQL_BATCH_FLUSH_MS, int _maxTask = 10000);
+        bool                on() const { return threadNumber > 0; }
+        // 只接受STMT_USER_INSERT的单行任务，队列满或没有初始化时返回false
+        bool                submit(sqlTask* task);
+};
@@ -2,14 +2,22 @@
 #include <string>
 #include <stdlib.h>
 #include <list>
+#include <vector>
+#include <time.h>
 #include <pthread.h>
 #include <mysql/mysql.h>
 #include "sql_connection.h"
 
 connectionPool::connectionPool()
 {
+    maxConn = 0;
+    minConn = 0;
     curConn = 0;
     freeConn = 0;
+    pending = 0;
+    started = false;
+    stopping = false;
+    memset(&stats, 0, sizeof(stats));
 }
 
 connectionPool* connectionPool::GetInstance()
@@ -18,9 +26,111 @@ connectionPool* connectionPool::GetInstance()
     return &connPool;
 }
 
+// 取连接、还连接时记录的空闲时刻只用于毫秒级的校验间隔，读共享时钟即可
+uint64_t connectionPool::nowMs()
+{
+    coarseClock::refresh();
+    return coarseClock::nowMs();
+}
+
+uint64_t connectionPool::nowUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// cond按CLOCK_REALTIME计算超时，返回ms毫秒之后的时刻
+static struct timespec realtimeAfter(int ms)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (long)(ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec ++ ;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+static bool realtimePassed(const struct timespec& t)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec > t.tv_sec || (ts.tv_sec == t.tv_sec && ts.tv_nsec >= t.tv_nsec);
+}
+
+// 建立一条新连接，失败返回NULL，不持有锁调用
+sqlConn* connectionPool::Connect()
+{
+    MYSQL* con = mysql_init(NULL);
+    if (con == NULL)
+    {
+        LOG_ERROR("MySQL init failed");
+        return NULL;
+    }
+    unsigned int timeout = POOL_CONNECT_TIMEOUT;
+    mysql_options(con, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    if (!mysql_real_connect(con, url.c_str(), user.c_str(), passwd.c_str(), dbName.c_str(), port, NULL, 0))
+    {
+        LOG_ERROR("MySQL connect failed: %s", mysql_error(con));
+        mysql_close(con);
+        return NULL;
+    }
+
+    sqlConn* conn = new sqlConn;
+    conn->mysql = con;
+    conn->broken = false;
+    return conn;
+}
+
+// 关闭连接和它上面的预处理语句，不持有锁调用
+void connectionPool::Close(sqlConn* conn)
+{
+    for (map<int, MYSQL_STMT*>::iterator it = conn->stmts.begin(); it != conn->stmts.end(); it ++ )
+    {
+        mysql_stmt_close(it->second);
+    }
+    mysql_close(conn->mysql);
+    delete conn;
+}
+
+// 按最后使用时间从新到旧的顺序放回空闲链表，调用时持有锁
+void connectionPool::PushIdle(sqlConn* conn, uint64_t lastUsed)
+{
+    idleConn idle;
+    idle.conn = conn;
+    idle.lastUsed = lastUsed;
+    idle.lastChecked = nowMs();
+
+    list<idleConn>::iterator it = connList.begin();
+    while (it != connList.end() && it->lastUsed > lastUsed) it ++ ;
+    connList.insert(it, idle);
+    freeConn ++ ;
+}
+
+// 并行建立初始连接的线程
+void* connectionPool::warmUp(void* arg)
+{
+    connectionPool* pool = (connectionPool*)arg;
+    mysql_thread_init();
+    sqlConn* con = pool->Connect();
+
+    pool->lock.lock();
+    pool->pending -- ;
+    if (con) pool->PushIdle(con, nowMs());
+    pool->lock.unlock();
+    if (con) pool->available.signal();
+
+    mysql_thread_end();
+    return NULL;
+}
+
 // 初始化数据库连接池
 void connectionPool::init(string _url, string _user, string _passwd, string _dbName, 
-                          int _port, int _maxConn, int _closeLog)
+                          int _port, int _maxConn, int _closeLog, int _minConn)
 {
     // 初始化数据库信息
     url = _url;
@@ -29,88 +139,242 @@ void connectionPool::init(string _url, string _user, string _passwd, string _dbN
     dbName = _dbName;
     port = _port;
     closeLog = _closeLog;
+    maxConn = _maxConn > 0 ? _maxConn : 1;
+    minConn = _minConn > 0 ? _minConn : maxConn / 4;
+    if (minConn < 1) minConn = 1;
+    if (minConn > maxConn) minConn = maxConn;
 
-    // 创建maxConn条数据库连接
-    for (int i = 0; i < maxConn; i ++ )
+    // 多线程同时mysql_init之前必须先初始化客户端库
+    mysql_library_init(0, NULL, NULL);
+
+    // 同时建立minConn条连接，启动时间取决于最慢的一条而不是所有连接之和
+    std::vector<pthread_t> threads;
+    lock.lock();
+    pending += minConn;
+    lock.unlock();
+    for (int i = 0; i < minConn; i ++ )
     {
-        MYSQL* con = NULL;
-        con = mysql_init(con);  
-        // 初始化一个MYSQL对象
-        if (con == NULL)
-        {
-            LOG_ERROR("MySQL failed...");
-            exit(1);
-        }
-        con = mysql_real_connect(con, url.c_str(), user.c_str(), passwd.c_str(), dbName.c_str(), port, NULL, 0);
-        // mysql_real_connect用于建立一个到MySQL数据库的连接，con变为连接句柄
-        connList.push_back(con);
-        freeConn++;
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, warmUp, this) == 0) threads.push_back(tid);
+        else warmUp(this);
     }
+    for (size_t i = 0; i < threads.size(); i ++ ) pthread_join(threads[i], NULL);
 
-    // 创建信号量
-    reserve = sem(freeConn);
+    if (freeConn < minConn) LOG_ERROR("MySQL warm-up: %d of %d connections opened", freeConn, minConn);
+
+    stopping = false;
+    started = pthread_create(&maintainer, NULL, maintain, this) == 0;
 }
 
-// 从数据库连接池中获取一个可用连接，当有请求时，同时更新使用和空闲连接数
-MYSQL* connectionPool::GetConnection()
+// 从数据库连接池中获取一个可用连接
+// 有空闲连接直接取；总数没到maxConn就新建；否则等别人归还，超过timeoutMs返回NULL
+sqlConn* connectionPool::GetConnection(int timeoutMs)
 {
-    MYSQL* con = NULL;
-    if (connList.empty()) return NULL;
-    // 如果连接池为空，返回空
+    uint64_t begin = nowUs();
+    struct timespec deadline;
+    if (timeoutMs >= 0) deadline = realtimeAfter(timeoutMs);
+    bool waited = false;
+    sqlConn* con = NULL;
+
+    lock.lock();
+    while (!stopping)
+    {
+        bool connectFailed = false;
+        if (!connList.empty())
+        {
+            idleConn idle = connList.front();
+            connList.pop_front();
+            freeConn -- ;
 
-    reserve.wait(); 
-    // wait()函数会将信号量的值减1，如果信号量的值为0，则阻塞等待
-    // 也就是说，如果当前没有空闲连接，那么就会阻塞等待
-    lock.lock(); 
-    // 这里加锁的目的是为了保证curConn和freeConn的一致性
-    con = connList.front();
-    connList.pop_front();
+            // 空闲太久的连接可能已被服务器断开，先ping确认
+            uint64_t last = idle.lastUsed > idle.lastChecked ? idle.lastUsed : idle.lastChecked;
+            uint64_t now = nowMs();
+            if (now <= last || now - last < (uint64_t)POOL_VALIDATE_MS)
+            {
+                con = idle.conn;
+                break;
+            }
+            pending ++ ;
+            lock.unlock();
+            bool alive = mysql_ping(idle.conn->mysql) == 0;
+            if (!alive) Close(idle.conn);
+            lock.lock();
+            pending -- ;
+            if (alive)
+            {
+                con = idle.conn;
+                break;
+            }
+            stats.broken ++ ;
+            continue;
+        }
+        else if (curConn + freeConn + pending < maxConn)
+        {
+            pending ++ ;
+            lock.unlock();
+            con = Connect();
+            lock.lock();
+            pending -- ;
+            if (con) break;
+            connectFailed = true;
+        }
 
-    freeConn -- ;
-    curConn ++ ;
+        if (timeoutMs >= 0 && realtimePassed(deadline)) break;
+        waited = true;
 
+        // 建立连接失败时隔一会儿再试，不在数据库故障时空转
+        struct timespec until = connectFailed ? realtimeAfter(POOL_RETRY_MS) : deadline;
+        if (timeoutMs >= 0 && connectFailed && realtimePassed(deadline)) until = deadline;
+        if (timeoutMs < 0 && !connectFailed) available.wait(lock.get());
+        else available.timewait(lock.get(), until);
+    }
+
+    uint64_t waitUs = nowUs() - begin;
+    if (con)
+    {
+        curConn ++ ;
+        stats.acquired ++ ;
+    }
+    else if (!stopping) stats.timeouts ++ ;
+    if (waited)
+    {
+        stats.waited ++ ;
+        stats.waitUs += waitUs;
+        if (waitUs > stats.maxWaitUs) stats.maxWaitUs = waitUs;
+    }
     lock.unlock();
     return con;
 }
 
 // 释放当前使用的连接
-bool connectionPool::ReleaseConnection(MYSQL* con)
+bool connectionPool::ReleaseConnection(sqlConn* con)
 {
     if (con == NULL) return false;
 
-    // 加锁
     lock.lock();
-    connList.push_back(con);
-    // 释放连接，空闲连接数加1，把当前的连接放回连接池
-    freeConn ++ ;
     curConn -- ;
+    // 已断开的连接不放回去，后台线程会把总数补回minConn，不够用时GetConnection也会新建
+    if (stopping || con->broken)
+    {
+        if (con->broken) stats.broken ++ ;
+        lock.unlock();
+        Close(con);
+        available.signal();
+        return true;
+    }
+    // 放在链表最前面，常用的连接保持热的，不常用的留在后面等着被回收
+    PushIdle(con, nowMs());
     lock.unlock();
 
-    // 信号量加1
-    reserve.post();
+    available.signal();
     return true;
 }
 
-// 销毁数据库连接池
-void connectionPool::DestroyPool()
+void* connectionPool::maintain(void* arg)
+{
+    connectionPool* pool = (connectionPool*)arg;
+    mysql_thread_init();
+
+    pool->lock.lock();
+    while (!pool->stopping)
+    {
+        pool->stopped.timewait(pool->lock.get(), realtimeAfter(POOL_MAINTAIN_MS));
+        if (pool->stopping) break;
+        pool->lock.unlock();
+        pool->Maintain();
+        pool->lock.lock();
+    }
+    pool->lock.unlock();
+
+    mysql_thread_end();
+    return NULL;
+}
+
+// 后台检查：ping空闲较久的连接，关闭断开的和多于minConn且空闲太久的，再把总数补回minConn
+// ping和建立连接都在锁外进行，期间这些连接计入pending
+void connectionPool::Maintain()
 {
+    std::vector<idleConn> check;
+    std::vector<sqlConn*> expired;
+
+    // 在锁内取时间，并且按0截断：否则锁外取时间之后归还的连接lastUsed比now大，无符号相减会下溢成极大的空闲时长
     lock.lock();
-    if (!connList.empty())
+    uint64_t now = nowMs();
+    int total = curConn + freeConn + pending;
+    list<idleConn>::iterator it = connList.begin();
+    while (it != connList.end())
     {
-        // 因为connList是一个list，在内存中是不连续存储的，不能通过数组的方式直接释放
-        // 迭代器使用了一种统一的方式来遍历容器，不管容器是什么类型
-        list<MYSQL*>::iterator it;
-        for (it = connList.begin(); it != connList.end(); it ++ )
+        uint64_t last = it->lastUsed > it->lastChecked ? it->lastUsed : it->lastChecked;
+        uint64_t idleMs = now > it->lastUsed ? now - it->lastUsed : 0;
+        uint64_t uncheckedMs = now > last ? now - last : 0;
+        if (idleMs >= (uint64_t)POOL_IDLE_MS && total > minConn)
         {
-            MYSQL* con = *it;
-            mysql_close(con);
-            // 关闭连接
+            expired.push_back(it->conn);
+            total -- ;
         }
-        curConn = 0;
-        freeConn = 0;
-        connList.clear();
+        else if (uncheckedMs >= (uint64_t)POOL_VALIDATE_MS) check.push_back(*it);
+        else
+        {
+            it ++ ;
+            continue;
+        }
+        it = connList.erase(it);
+        freeConn -- ;
     }
+    pending += check.size();
+    int refill = minConn - total > 0 ? minConn - total : 0;
+    pending += refill;
     lock.unlock();
+
+    for (size_t i = 0; i < expired.size(); i ++ ) Close(expired[i]);
+
+    int broken = 0;
+    for (size_t i = 0; i < check.size(); i ++ )
+    {
+        bool alive = mysql_ping(check[i].conn->mysql) == 0;
+        if (!alive)
+        {
+            Close(check[i].conn);
+            check[i].conn = NULL;
+            broken ++ ;
+        }
+    }
+
+    // 断开的连接也要补上，保证至少有minConn条
+    std::vector<sqlConn*> fresh;
+    for (int i = 0; i < refill + broken; i ++ )
+    {
+        sqlConn* con = Connect();
+        if (con) fresh.push_back(con);
+    }
+
+    lock.lock();
+    pending -= check.size() + refill;
+    for (size_t i = 0; i < check.size(); i ++ )
+    {
+        if (check[i].conn) PushIdle(check[i].conn, check[i].lastUsed);
+    }
+    // 补连接期间可能有人新建了连接，超过maxConn的部分直接关闭
+    for (size_t i = 0; i < fresh.size(); i ++ )
+    {
+        if (curConn + freeConn + pending < maxConn) PushIdle(fresh[i], now);
+        else
+        {
+            Close(fresh[i]);
+            fresh[i] = NULL;
+        }
+    }
+    stats.broken += broken;
+    poolStats cur = stats;
+    cur.inUse = curConn;
+    cur.idle = freeConn;
+    cur.total = curConn + freeConn + pending;
+    lock.unlock();
+    available.broadcast();
+
+    LOG_INFO("sql pool: in use %d, idle %d, total %d, acquired %lu, waited %lu, timeouts %lu, avg wait %luus, max wait %luus, broken %lu",
+             cur.inUse, cur.idle, cur.total, cur.acquired, cur.waited, cur.timeouts,
+             cur.waited ? cur.waitUs / cur.waited : 0, cur.maxWaitUs, cur.broken);
 }
 
 // 返回空闲连接数
@@ -119,20 +383,176 @@ int connectionPool::GetFreeConn()
     return this->freeConn;
 }
 
+poolStats connectionPool::GetStats()
+{
+    lock.lock();
+    poolStats cur = stats;
+    cur.inUse = curConn;
+    cur.idle = freeConn;
+    cur.total = curConn + freeConn + pending;
+    lock.unlock();
+    return cur;
+}
+
+// 销毁数据库连接池，先停掉后台线程，再关闭所有空闲连接，正在使用的连接归还时关闭
+void connectionPool::DestroyPool()
+{
+    lock.lock();
+    stopping = true;
+    stopped.signal();
+    available.broadcast();
+    lock.unlock();
+    if (started) pthread_join(maintainer, NULL);
+    started = false;
+
+    lock.lock();
+    list<idleConn>::iterator it;
+    for (it = connList.begin(); it != connList.end(); it ++ ) Close(it->conn);
+    freeConn = 0;
+    connList.clear();
+    lock.unlock();
+}
+
 connectionPool::~connectionPool()
 {
     DestroyPool();
 }
 
-connectionRAII::connectionRAII(MYSQL** SQL, connectionPool* connPool)
+connectionRAII::connectionRAII(MYSQL** SQL, connectionPool* connPool, int timeoutMs)
 {
-    *SQL = connPool->GetConnection();
+    conRAII = connPool->GetConnection(timeoutMs);
     // SQL是一个MYSQL*类型的指针，*SQL是一个MYSQL*类型的对象，用于存储从连接池中取出的连接
-    conRAII = *SQL;
+    *SQL = conRAII ? conRAII->mysql : NULL;
     poolRAII = connPool;
 }
 
 connectionRAII::~connectionRAII()
 {
     poolRAII->ReleaseConnection(conRAII);
-}
\ No newline at end of file
+}
+
+static string stmtText(SQL_STMT id, int rows)
+{
+    switch (id)
+    {
+    case STMT_USER_PASSWD:
+        return "SELECT passwd FROM user WHERE username = ? LIMIT 1";
+    case STMT_USER_INSERT:
+    {
+        string sql = "INSERT INTO user(username, passwd) VALUES(?, ?)";
+        for (int i = 1; i < rows; i ++ ) sql += ", (?, ?)";
+        return sql;
+    }
+    default:
+        return "";
+    }
+}
+
+// 取出这条连接上缓存的语句，没有就准备一条放进缓存
+MYSQL_STMT* connectionRAII::Prepare(SQL_STMT id, int rows)
+{
+    int key = id * 65536 + rows;
+    map<int, MYSQL_STMT*>::iterator it = conRAII->stmts.find(key);
+    if (it != conRAII->stmts.end()) return it->second;
+
+    MYSQL_STMT* stmt = mysql_stmt_init(conRAII->mysql);
+    if (stmt == NULL) return NULL;
+    string sql = stmtText(id, rows);
+    if (mysql_stmt_prepare(stmt, sql.c_str(), sql.size()))
+    {
+        mysql_stmt_close(stmt);
+        return NULL;
+    }
+    conRAII->stmts[key] = stmt;
+    return stmt;
+}
+
+// 绑定参数并执行，成功返回语句，失败返回NULL并把错误码放在err中
+// 服务器丢弃了语句句柄时重新准备一次；连接断开时标记broken，归还时关闭
+MYSQL_STMT* connectionRAII::Run(SQL_STMT id, int rows, const string* params, int count, int& err)
+{
+    err = -1;
+    if (conRAII == NULL) return NULL;
+
+    vector<MYSQL_BIND> binds(count);
+    vector<unsigned long> lengths(count);
+    if (count > 0) memset(&binds[0], 0, sizeof(MYSQL_BIND) * count);
+    for (int i = 0; i < count; i ++ )
+    {
+        lengths[i] = params[i].size();
+        binds[i].buffer_type = MYSQL_TYPE_STRING;
+        binds[i].buffer = (void*)params[i].c_str();
+        binds[i].buffer_length = params[i].size();
+        binds[i].length = &lengths[i];
+    }
+
+    for (int attempt = 0; attempt < 2; attempt ++ )
+    {
+        MYSQL_STMT* stmt = Prepare(id, rows);
+        if (stmt == NULL)
+        {
+            err = mysql_errno(conRAII->mysql);
+        }
+        else
+        {
+            if ((count == 0 || !mysql_stmt_bind_param(stmt, &binds[0])) && mysql_stmt_execute(stmt) == 0)
+            {
+                err = 0;
+                return stmt;
+            }
+            err = mysql_stmt_errno(stmt);
+            if (err == ER_UNKNOWN_STMT_HANDLER || err == ER_NEED_REPREPARE || err == CR_SERVER_GONE_ERROR ||
+                err == CR_SERVER_LOST)
+            {
+                conRAII->stmts.erase(id * 65536 + rows);
+                mysql_stmt_close(stmt);
+            }
+        }
+        if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+        {
+            conRAII->broken = true;
+            err = -1;
+            return NULL;
+        }
+        if (err != ER_UNKNOWN_STMT_HANDLER && err != ER_NEED_REPREPARE) break;
+    }
+    if (err == 0) err = -1;
+    return NULL;
+}
+
+int connectionRAII::Execute(SQL_STMT id, const string* params, int count, int rows)
+{
+    int err;
+    Run(id, rows, params, count, err);
+    return err;
+}
+
+int connectionRAII::QueryOne(SQL_STMT id, const string* params, int count, string& out)
+{
+    int err;
+    MYSQL_STMT* stmt = Run(id, 1, params, count, err);
+    if (stmt == NULL) return -1;
+
+    char buf[256];
+    unsigned long len = 0;
+    MYSQL_BIND field;
+    memset(&field, 0, sizeof(field));
+    field.buffer_type = MYSQL_TYPE_STRING;
+    field.buffer = buf;
+    field.buffer_length = sizeof(buf);
+    field.length = &len;
+
+    int ret = -1;
+    if (!mysql_stmt_bind_result(stmt, &field) && mysql_stmt_store_result(stmt) == 0)
+    {
+        int fetch = mysql_stmt_fetch(stmt);
+        if (fetch == 0 || fetch == MYSQL_DATA_TRUNCATED)
+        {
+            out.assign(buf, len < sizeof(buf) ? len : sizeof(buf));
+            ret = 1;
+        }
+        else if (fetch == MYSQL_NO_DATA) ret = 0;
+    }
+    mysql_stmt_free_result(stmt);
+    return ret;
+}
@@ -3,25 +3,93 @@
 
 #include <stdio.h>
 #include <list>
+#include <map>
+#include <string>
+#include <stdint.h>
 #include <mysql/mysql.h>
+#include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
 #include <error.h>
 #include <string.h>
 #include "../lock/locker.h"
 #include "../log/log.h"
+#include "../clock/coarse_clock.h"
 
+const int POOL_CONNECT_TIMEOUT = 3;         // 建立连接的超时，秒
+const int POOL_VALIDATE_MS = 5000;          // 空闲超过这个时间的连接取出前先ping
+const int POOL_IDLE_MS = 60000;             // 空闲超过这个时间且多于minConn的连接关闭
+const int POOL_MAINTAIN_MS = 5000;          // 后台检查的间隔
+const int POOL_RETRY_MS = 200;              // 建立连接失败后重试前的等待
+
+// 预处理语句编号，语句文本见sql_connection.cpp中的stmtText
+// 每条连接第一次用到某条语句时才准备，之后一直复用，连接重建后自然重新准备
+enum SQL_STMT
+{
+    STMT_USER_PASSWD,           // 按用户名查密码，参数：用户名
+    STMT_USER_INSERT,           // 插入rows个用户，每行参数：用户名、密码
+    STMT_NUM
+};
+
+// 池中的一条连接和它上面已经准备好的预处理语句
+struct sqlConn
+{
+    MYSQL*                  mysql;
+    map<int, MYSQL_STMT*>   stmts;          // 键为语句编号 * 65536 + 行数
+    bool                    broken;         // 执行时发现连接已断开，归还时直接关闭
+};
+
+// 连接池的运行指标
+struct poolStats
+{
+    int             inUse;          // 正在使用的连接数
+    int             idle;           // 空闲连接数
+    int             total;          // 已建立和正在建立的连接总数
+    unsigned long   acquired;       // 成功取得连接的次数
+    unsigned long   waited;         // 需要等待的次数
+    unsigned long   timeouts;       // 等待超时而失败的次数
+    unsigned long   waitUs;         // 累计等待时间，微秒
+    unsigned long   maxWaitUs;      // 最长一次等待，微秒
+    unsigned long   broken;         // 检查出已断开而关闭的连接数
+};
+
+// 连接数在minConn和maxConn之间伸缩：启动时并行建立minConn条连接，
+// 不够用时按需新建，空闲太久的连接由后台线程ping检查、关闭多余的，并把断开的补回minConn
 class connectionPool
 {
     private:
+        struct idleConn
+        {
+            sqlConn*    conn;
+            uint64_t    lastUsed;       // 最后一次归还的时间，毫秒
+            uint64_t    lastChecked;    // 最后一次确认可用的时间，毫秒
+        };
+
         int            maxConn;      // 最大连接数
+        int            minConn;      // 最少保持的连接数
         int            curConn;      // 当前已经使用的连接数
         int            freeConn;     // 当前空闲连接数
+        int            pending;      // 正在建立或正在后台检查的连接数，计入总数
         locker         lock;         // 互斥锁
-        list<MYSQL*>   connList;     // 连接池
-        sem reserve;                 // 信号量，确保同一时间只有一个线程访问共享资源
+        cond           available;    // 有连接归还、可以新建连接或连接池关闭时通知
+        cond           stopped;      // 连接池关闭时通知后台线程
+        list<idleConn> connList;     // 空闲连接，最近归还的在前
+        pthread_t      maintainer;   // 后台检查线程
+        bool           started;
+        bool           stopping;
+        poolStats      stats;
 
         connectionPool();
         ~connectionPool();
 
+        static uint64_t nowMs();
+        static uint64_t nowUs();
+        static void*    warmUp(void* arg);
+        static void*    maintain(void* arg);
+        sqlConn*        Connect();
+        static void     Close(sqlConn* conn);
+        void            Maintain();
+        void            PushIdle(sqlConn* conn, uint64_t lastUsed);
+
     public:
         string url;                  // 主机地址
         string user;                 // 用户
@@ -30,10 +98,14 @@ class connectionPool
         int    port;                 // 端口
         int    closeLog;             // 日志开关
 
-        void     init(string _url, string _user, string _passwd, string _dbName, int _port, int _maxConn, int _closeLog);
-        MYSQL*   GetConnection();
-        bool     ReleaseConnection(MYSQL* conn);
+        // _minConn不大于0时取maxConn的四分之一，至少1条
+        void     init(string _url, string _user, string _passwd, string _dbName, int _port, int _maxConn, int _closeLog,
+                      int _minConn = 0);
+        // timeoutMs小于0时一直等，等不到返回NULL
+        sqlConn* GetConnection(int timeoutMs = -1);
+        bool     ReleaseConnection(sqlConn* conn);
         int      GetFreeConn();
+        poolStats GetStats();
         void     DestroyPool();
         static   connectionPool* GetInstance();
 };
@@ -42,11 +114,20 @@ class connectionPool
 class connectionRAII
 {
     private:
-        MYSQL*            conRAII;      // 一个MYSQL连接
+        sqlConn*          conRAII;      // 一个MYSQL连接
         connectionPool*   poolRAII;     // 连接池
-    
+
+        MYSQL_STMT*       Prepare(SQL_STMT id, int rows);
+        MYSQL_STMT*       Run(SQL_STMT id, int rows, const string* params, int count, int& err);
+
     public:
-        connectionRAII(MYSQL** con, connectionPool* connPool);  
-        // 从连接池中取一个连接
+        connectionRAII(MYSQL** con, connectionPool* connPool, int timeoutMs = -1);
+        // 从连接池中取一个连接，超时取不到时*con为NULL
         ~connectionRAII();
-};
\ No newline at end of file
+
+        // 用缓存的预处理语句执行，params按语句中?的顺序绑定为字符串
+        // 返回0或MySQL错误码，拿不到连接或连接断开时返回-1
+        int               Execute(SQL_STMT id, const string* params, int count, int rows = 1);
+        // 执行查询并取第一行第一列，返回1有结果、0没有结果、-1出错
+        int               QueryOne(SQL_STMT id, const string* params, int count, string& out);
+};
@@ -0,0 +1,75 @@
+#include "sql_executor.h"
+
+sqlExecutor::sqlExecutor() : connPool(NULL), threadNumber(0), maxTask(0)
+{
+}
+
+sqlExecutor* sqlExecutor::GetInstance()
+{
+    static sqlExecutor executor;
+    return &executor;
+}
+
+bool sqlExecutor::init(connectionPool* _connPool, int _threadNumber, int _maxTask)
+{
+    if (!_connPool || _threadNumber <= 0 || _maxTask <= 0) return false;
+    connPool = _connPool;
+    maxTask = _maxTask;
+
+    for (int i = 0; i < _threadNumber; i ++ )
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker, this) != 0) break;
+        pthread_detach(tid);
+        threadNumber ++ ;
+    }
+    return threadNumber > 0;
+}
+
+bool sqlExecutor::submit(sqlTask* task)
+{
+    if (threadNumber == 0) return false;
+
+    queueLocker.lock();
+    if ((int)taskQueue.size() >= maxTask)
+    {
+        queueLocker.unlock();
+        return false;
+    }
+    taskQueue.push_back(task);
+    queueLocker.unlock();
+    queueState.post();
+    return true;
+}
+
+void* sqlExecutor::worker(void* arg)
+{
+    sqlExecutor* executor = (sqlExecutor*)arg;
+    executor->run();
+    return executor;
+}
+
+void sqlExecutor::run()
+{
+    while (true)
+    {
+        queueState.wait();
+        queueLocker.lock();
+        if (taskQueue.empty())
+        {
+            queueLocker.unlock();
+            continue;
+        }
+        sqlTask* task = taskQueue.front();
+        taskQueue.pop_front();
+        queueLocker.unlock();
+
+        // 连接只在执行这一条语句期间占用
+        {
+            MYSQL* mysql = NULL;
+            connectionRAII mysqlConn(&mysql, connPool, SQL_WAIT_MS);
+            task->result = mysql ? mysqlConn.Execute(task->stmt, &task->params[0], task->params.size()) : -1;
+        }
+        task->done(task);
+    }
+}
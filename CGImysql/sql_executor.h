@@ -0,0 +1,51 @@
+#pragma once
+
+
+#include <list>
+#include <vector>
+#include <string>
+#include <pthread.h>
+#include <mysql/mysql.h>
+#include "../lock/locker.h"
+#include "sql_connection.h"
+
+using namespace std;
+
+const int SQL_WAIT_MS = 1000;       // 等待数据库连接的上限，超时按服务不可用处理
+
+// 交给sqlExecutor执行的一条语句，由提交者持有，完成前不能释放
+struct sqlTask
+{
+    SQL_STMT        stmt;               // 要执行的预处理语句
+    vector<string>  params;             // 按语句中?的顺序绑定
+    int             result;             // 0为成功，拿不到连接或连接断开时为-1，其余为错误码
+    void            (*done)(sqlTask* task);     // 在执行线程中回调
+    void*           arg;
+    unsigned        ticket;             // 提交者用来识别过期的结果
+};
+
+// 异步执行数据库语句
+// 请求线程只把任务放进队列就返回，不等结果；执行线程各自从连接池取连接执行，完成后回调done
+// 执行线程数与连接池大小相同，连接池的大小就是同时执行的语句数，工作线程不再因数据库延迟而阻塞
+class sqlExecutor
+{
+    private:
+        connectionPool*     connPool;
+        int                 threadNumber;
+        int                 maxTask;        // 队列中允许的最大任务数
+        list<sqlTask*>      taskQueue;
+        locker              queueLocker;
+        sem                 queueState;     // 队列中待执行的任务数
+
+        sqlExecutor();
+
+        static void*        worker(void* arg);
+        void                run();
+
+    public:
+        static sqlExecutor* GetInstance();
+
+        bool                init(connectionPool* _connPool, int _threadNumber, int _maxTask = 10000);
+        bool                on() const { return threadNumber > 0; }
+        bool                submit(sqlTask* task);     // 队列满或没有初始化时返回false
+};
@@ -0,0 +1,127 @@
+#include "cpu_affinity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <dirent.h>
+
+thread_local int cpuAffinity::threadNode = 0;
+
+cpuAffinity::cpuAffinity() : enabled(false), reactorNum(1), cpuNode(CPU_SETSIZE, 0), nodeNum(1)
+{
+}
+
+cpuAffinity* cpuAffinity::GetInstance()
+{
+    static cpuAffinity affinity;
+    return &affinity;
+}
+
+// 解析"0-3,8,10-11"这样的CPU列表
+bool cpuAffinity::parseList(const string& list, vector<int>& out)
+{
+    const char* p = list.c_str();
+    while (*p)
+    {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p) return false;
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1) return false;
+            p = end;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE) return false;
+        for (long cpu = first; cpu <= last; cpu ++ ) out.push_back((int)cpu);
+
+        if (*p == ',') p ++ ;
+        else if (*p) return false;
+    }
+    return !out.empty();
+}
+
+// 从sysfs的/sys/devices/system/cpu/cpuN/nodeM目录名得到CPU所在的节点，没有NUMA信息时为0
+int cpuAffinity::readNode(int cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR* dir = opendir(path);
+    if (!dir) return 0;
+
+    int node = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        int n;
+        if (sscanf(entry->d_name, "node%d", &n) == 1)
+        {
+            node = n;
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+bool cpuAffinity::init(const string& cpuList, int _reactorNum)
+{
+    enabled = false;
+    reactorNum = _reactorNum > 0 ? _reactorNum : 1;
+    cpus.clear();
+    nodeNum = 1;
+    if (cpuList.empty()) return true;
+
+    if (cpuList == "auto")
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) != 0) return false;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu ++ )
+        {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+    }
+    else if (!parseList(cpuList, cpus))
+    {
+        cpus.clear();
+        return false;
+    }
+
+    for (size_t i = 0; i < cpus.size(); i ++ )
+    {
+        int node = readNode(cpus[i]);
+        if (node >= AFFINITY_NODE_MAX) node %= AFFINITY_NODE_MAX;
+        cpuNode[cpus[i]] = node;
+        if (node + 1 > nodeNum) nodeNum = node + 1;
+    }
+    enabled = !cpus.empty();
+    return enabled;
+}
+
+int cpuAffinity::reactorCpu(int id) const
+{
+    return cpus.empty() ? -1 : cpus[id % cpus.size()];
+}
+
+int cpuAffinity::workerCpu(int id) const
+{
+    return cpus.empty() ? -1 : cpus[(reactorNum + id) % cpus.size()];
+}
+
+int cpuAffinity::nodeOf(int cpu) const
+{
+    return cpu < 0 || cpu >= CPU_SETSIZE ? 0 : cpuNode[cpu];
+}
+
+bool cpuAffinity::pin(int cpu)
+{
+    if (cpu < 0) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) return false;
+    // 之后本线程首次写入的页面由内核分配在这个节点上
+    threadNode = cpuNode[cpu];
+    return true;
+}
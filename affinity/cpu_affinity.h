@@ -0,0 +1,51 @@
+#pragma once
+
+
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const int AFFINITY_NODE_MAX = 8;     // 按节点分开的数据结构最多区分的NUMA节点数
+
+// 反应堆和工作线程的绑核策略
+// cpuList为空时不绑核，"auto"表示进程允许运行的所有CPU，否则形如"0-3,8,10-11"
+// 反应堆依次占用列表中的前reactorNum个CPU，工作线程接着往后排，CPU不够时从头循环
+// 线程绑核后记下自己所在的NUMA节点，缓冲区池和线程池据此优先使用同一节点上的内存和线程
+class cpuAffinity
+{
+    private:
+        bool            enabled;
+        int             reactorNum;
+        vector<int>     cpus;
+        vector<int>     cpuNode;        // 下标为CPU编号，值为所在节点
+        int             nodeNum;
+
+        static thread_local int threadNode;
+
+        cpuAffinity();
+
+        static bool     parseList(const string& list, vector<int>& out);
+        static int      readNode(int cpu);
+        bool            pin(int cpu);
+
+    public:
+        static cpuAffinity* GetInstance();
+
+        bool            init(const string& cpuList, int _reactorNum);
+        bool            on() const { return enabled; }
+        int             nodes() const { return nodeNum; }
+        int             cpuCount() const { return (int)cpus.size(); }
+        int             reactorCpu(int id) const;
+        int             workerCpu(int id) const;
+        int             nodeOf(int cpu) const;
+
+        // 在线程自己的入口调用，失败时线程继续不绑核运行
+        bool            pinReactor(int id) { return enabled && pin(reactorCpu(id)); }
+        bool            pinWorker(int id) { return enabled && pin(workerCpu(id)); }
+
+        // 当前线程所在的NUMA节点，没有绑核的线程为0
+        static int      currentNode() { return threadNode; }
+};
@@ -0,0 +1,176 @@
+// 请求解析扫描的微基准：逐字节的旧解析方式 vs httpScanner的scalar/SSE2/AVX2实现
+// 输入是几组录下来的浏览器请求头，每轮把所有请求按行切开，并在请求行上找两个分隔空白
+// 构建（在仓库根目录）：
+//   g++ -std=c++11 -O2 -I. bench/scanner_bench.cpp http/http_scanner.cpp -o scanner_bench
+// 运行：./scanner_bench [轮数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "http/http_scanner.h"
+
+using namespace std;
+
+typedef const char* (*findPairFn)(const char* p, const char* end, char a, char b);
+
+// 录下来的请求头
+static const char* samples[] =
+{
+    // Chrome 打开首页
+    "GET / HTTP/1.1\r\n"
+    "Host: 192.168.1.20:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "\r\n",
+
+    // Firefox 取图片，带cookie
+    "GET /xxx.jpg HTTP/1.1\r\n"
+    "Host: 192.168.1.20:9006\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+    "Accept: image/avif,image/webp,*/*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://192.168.1.20:9006/5\r\n"
+    "Cookie: _ga=GA1.1.1804413389.1713340000; _ga_XYZ123=GS1.1.1713340000.1.1.1713340123.0.0.0; session=8f14e45fceea167a5a36dedd4bea2543\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "If-Modified-Since: Wed, 17 Apr 2024 08:00:00 GMT\r\n"
+    "\r\n",
+
+    // Safari 登录表单提交
+    "POST /2CGISQL.cgi HTTP/1.1\r\n"
+    "Host: 192.168.1.20:9006\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Origin: http://192.168.1.20:9006\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.4 Safari/605.1.15\r\n"
+    "Referer: http://192.168.1.20:9006/1\r\n"
+    "Content-Length: 25\r\n"
+    "Accept-Language: zh-CN,zh-Hans;q=0.9\r\n"
+    "\r\n",
+
+    // curl
+    "GET /log.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+};
+
+static const int SAMPLE_NUM = sizeof(samples) / sizeof(samples[0]);
+
+struct sample
+{
+    string  raw;
+    string  requestLine;        // 旧解析器把\r\n换成\0后strpbrk看到的请求行
+};
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 改动前的parseLine：逐字节找'\r'或'\n'
+static uint64_t parseLegacy(const sample& s)
+{
+    const char* buf = s.raw.data();
+    int readIdx = (int)s.raw.size();
+    uint64_t sum = 0;
+    for (int i = 0; i < readIdx; i ++ )
+    {
+        if (buf[i] == '\r' || buf[i] == '\n') sum += i;
+    }
+
+    // 改动前的parseRequestLine：strpbrk找方法后和URL后的空白
+    const char* text = s.requestLine.c_str();
+    const char* url = strpbrk(text, " \t");
+    url += strspn(url + 1, " \t") + 1;
+    const char* version = strpbrk(url, " \t");
+    return sum + (url - text) + (version - text);
+}
+
+static uint64_t parseScanner(const sample& s, findPairFn find)
+{
+    const char* begin = s.raw.data();
+    const char* end = begin + s.raw.size();
+    uint64_t sum = 0;
+    for (const char* p = begin; (p = find(p, end, '\r', '\n')) < end; p ++ ) sum += p - begin;
+
+    const char* text = begin;
+    const char* lineEnd = find(text, end, '\r', '\n');
+    const char* url = find(text, lineEnd, ' ', '\t');
+    url += strspn(url + 1, " \t") + 1;
+    const char* version = find(url, lineEnd, ' ', '\t');
+    return sum + (url - text) + (version - text);
+}
+
+int main(int argc, char* argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 2000000;
+
+    vector<sample> reqs(SAMPLE_NUM);
+    size_t bytes = 0;
+    for (int i = 0; i < SAMPLE_NUM; i ++ )
+    {
+        reqs[i].raw = samples[i];
+        reqs[i].requestLine = reqs[i].raw.substr(0, reqs[i].raw.find("\r\n"));
+        bytes += reqs[i].raw.size();
+    }
+
+    const char* names[] = {"legacy", "scalar", "sse2", "avx2"};
+    uint64_t expect = 0;
+    printf("%d requests, %zu bytes per round, %d rounds\n", SAMPLE_NUM, bytes, rounds);
+    printf("%-8s %12s %12s\n", "impl", "ns/request", "MB/s");
+    for (int k = 0; k < 4; k ++ )
+    {
+        findPairFn find = k == 0 ? NULL : httpScanner::impl(names[k]);
+        if (k > 0 && !find)
+        {
+            printf("%-8s %12s\n", names[k], "unsupported");
+            continue;
+        }
+
+        uint64_t sum = 0;
+        uint64_t start = nowNs();
+        for (int r = 0; r < rounds; r ++ )
+        {
+            for (int i = 0; i < SAMPLE_NUM; i ++ ) sum += k == 0 ? parseLegacy(reqs[i]) : parseScanner(reqs[i], find);
+        }
+        uint64_t cost = nowNs() - start;
+
+        // 各实现找到的位置必须一致
+        if (k == 0) expect = sum;
+        else if (sum != expect)
+        {
+            printf("%s: result mismatch\n", names[k]);
+            return 1;
+        }
+        double perReq = (double)cost / ((double)rounds * SAMPLE_NUM);
+        double mbps = (double)bytes * rounds / ((double)cost / 1e9) / (1024.0 * 1024.0);
+        printf("%-8s %12.1f %12.1f\n", names[k], perReq, mbps);
+    }
+    return 0;
+}
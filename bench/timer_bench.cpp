@@ -0,0 +1,211 @@
+// 定时器微基准：分层时间轮 vs 改动前的有序双向链表
+// 分别挂1k、10k、100k个连接定时器，测刷新（adjustTimer，每次请求都会调用）和到期处理（tick）的单次开销
+// 构建（在仓库根目录）：
+//   g++ -std=c++11 -O2 -pthread -I. bench/timer_bench.cpp timer/timer_wheel.cpp clock/coarse_clock.cpp -o timer_bench
+// 运行：./timer_bench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include "timer/timer.h"
+
+using namespace std;
+
+static const uint64_t TIMEOUT_MS = 3 * 5 * 1000;    // 与服务器相同：3 * TIMESLOT秒
+static const int WHEEL_OPS = 2000000;               // 时间轮每组刷新次数
+static const long LIST_WORK = 200000000;            // 链表每组大约走过的节点数，控制运行时间
+static const int TICK_INTERVAL_MS = 100;            // 与服务器默认的TICK_MS相同
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t rng = 88172645463325252ULL;
+static uint64_t nextRand()
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+// 改动前的timerList：按到期时间有序的双向链表，刷新时从原位置往后找插入点
+struct listTimer
+{
+    uint64_t    expireTime;
+    listTimer*  prev;
+    listTimer*  next;
+};
+
+class sortedList
+{
+    private:
+        listTimer*  head;
+        listTimer*  tail;
+
+        void insertAfter(listTimer* timer, listTimer* from)
+        {
+            listTimer* prev = from;
+            listTimer* tmp = from->next;
+            while (tmp && tmp->expireTime <= timer->expireTime)
+            {
+                prev = tmp;
+                tmp = tmp->next;
+            }
+            timer->prev = prev;
+            timer->next = tmp;
+            prev->next = timer;
+            if (tmp) tmp->prev = timer;
+            else tail = timer;
+        }
+
+    public:
+        sortedList() : head(NULL), tail(NULL) {}
+
+        // 按到期时间从小到大建表时直接挂到表尾，避免建表本身变成O(n^2)
+        void pushBack(listTimer* timer)
+        {
+            timer->prev = tail;
+            timer->next = NULL;
+            if (tail) tail->next = timer;
+            else head = timer;
+            tail = timer;
+        }
+
+        void addTimer(listTimer* timer)
+        {
+            timer->prev = timer->next = NULL;
+            if (!head)
+            {
+                head = tail = timer;
+                return;
+            }
+            if (timer->expireTime < head->expireTime)
+            {
+                timer->next = head;
+                head->prev = timer;
+                head = timer;
+                return;
+            }
+            insertAfter(timer, head);
+        }
+
+        void adjustTimer(listTimer* timer)
+        {
+            listTimer* tmp = timer->next;
+            if (!tmp || timer->expireTime < tmp->expireTime) return;
+            if (timer->prev) timer->prev->next = tmp;
+            else head = tmp;
+            tmp->prev = timer->prev;
+            insertAfter(timer, tmp);
+        }
+};
+
+static long fired = 0;
+static void onExpire(clientData* userData)
+{
+    fired ++ ;
+}
+
+// 刷新：随机挑一个连接，把到期时间推到现在之后TIMEOUT_MS，和WebServer::adjustTimer一样
+static double benchWheelAdjust(timerWheel& wheel, vector<clientData>& conns)
+{
+    int n = (int)conns.size();
+    uint64_t start = nowNs();
+    for (int i = 0; i < WHEEL_OPS; i ++ )
+    {
+        clientData& c = conns[nextRand() % n];
+        c.node.expireTime = coarseClock::nowMs() + TIMEOUT_MS;
+        wheel.adjustTimer(&c.node);
+    }
+    return (double)(nowNs() - start) / WHEEL_OPS;
+}
+
+// 到期：把所有定时器改到接下来一秒内到期，按服务器默认的TICK_MS节奏更新时钟并tick，
+// 只统计tick本身的耗时（包括逐毫秒推进和高层下放），按触发的定时器平摊
+static double benchWheelTick(timerWheel& wheel, vector<clientData>& conns)
+{
+    int n = (int)conns.size();
+    coarseClock::update();
+    uint64_t base = coarseClock::nowMs();
+    for (int i = 0; i < n; i ++ )
+    {
+        conns[i].node.expireTime = base + 1 + nextRand() % 1000;
+        wheel.adjustTimer(&conns[i].node);
+    }
+
+    fired = 0;
+    uint64_t cost = 0;
+    while (fired < n)
+    {
+        usleep(TICK_INTERVAL_MS * 1000);
+        coarseClock::update();
+        uint64_t start = nowNs();
+        wheel.tick();
+        cost += nowNs() - start;
+    }
+    return (double)cost / n;
+}
+
+static double benchListAdjust(int n)
+{
+    vector<listTimer> timers(n);
+    vector<uint64_t> expires(n);
+    sortedList list;
+    uint64_t base = coarseClock::nowMs();
+    for (int i = 0; i < n; i ++ ) expires[i] = base + 1000 + nextRand() % TIMEOUT_MS;
+    sort(expires.begin(), expires.end());
+    for (int i = 0; i < n; i ++ )
+    {
+        timers[i].expireTime = expires[i];
+        list.pushBack(&timers[i]);
+    }
+
+    // 刷新后的到期时间总是最晚的，平均要走过大半个链表
+    int ops = (int)(LIST_WORK / n);
+    uint64_t start = nowNs();
+    for (int i = 0; i < ops; i ++ )
+    {
+        listTimer& t = timers[nextRand() % n];
+        t.expireTime = base + TIMEOUT_MS + i;
+        list.adjustTimer(&t);
+    }
+    return (double)(nowNs() - start) / ops;
+}
+
+int main()
+{
+    const int sizes[] = {1000, 10000, 100000};
+    printf("%-8s %16s %16s %16s\n", "timers", "wheel adjust ns", "tick ns/expiry", "list adjust ns");
+    for (int k = 0; k < 3; k ++ )
+    {
+        int n = sizes[k];
+        timerWheel* wheel = new timerWheel;     // 各层槽数组较大，不放在栈上
+        vector<clientData> conns(n);
+        coarseClock::update();
+        uint64_t base = coarseClock::nowMs();
+        for (int i = 0; i < n; i ++ )
+        {
+            conns[i].sockfd = i;
+            conns[i].node.userData = &conns[i];
+            conns[i].node.callBack = onExpire;
+            conns[i].node.expireTime = base + 1000 + nextRand() % TIMEOUT_MS;
+            conns[i].timer = &conns[i].node;
+            wheel->addTimer(&conns[i].node);
+        }
+
+        double adjust = benchWheelAdjust(*wheel, conns);
+        double tick = benchWheelTick(*wheel, conns);
+        double list = benchListAdjust(n);
+        printf("%-8d %16.1f %16.1f %16.1f\n", n, adjust, tick, list);
+        delete wheel;
+    }
+    return 0;
+}
@@ -0,0 +1,148 @@
+// 用户表微基准：分片无锁读的userCache vs 原来的全局map<string, string>
+// 先装入100万用户，再让多个登录线程随机校验密码，同时一个注册线程不断插入新用户
+// 原来的登录路径不加锁直接读map，和注册并发时是数据竞争，这里对照组读写都加锁，是它正确的等价写法
+// 构建（在仓库根目录）：
+//   g++ -std=c++11 -O2 -pthread -I. bench/user_cache_bench.cpp cache/user_cache.cpp -o user_cache_bench
+// 运行：./user_cache_bench [用户数] [登录线程数] [每线程校验次数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "cache/user_cache.h"
+
+using namespace std;
+
+static int userNum = 1000000;
+static int loginThreads = 8;
+static int loginOps = 1000000;
+static const int WRITER_OPS = 100000;
+
+static vector<string> names;
+static vector<string> passwds;
+
+static map<string, string> users;
+static locker usersLock;
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct loginArg
+{
+    bool        useCache;
+    uint64_t    seed;
+    long        ok;
+};
+
+static void* loginWorker(void* arg)
+{
+    loginArg* a = (loginArg*)arg;
+    uint64_t rng = a->seed;
+    for (int i = 0; i < loginOps; i ++ )
+    {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        int id = rng % userNum;
+        bool ok;
+        if (a->useCache) ok = userCache::GetInstance()->Check(names[id].c_str(), passwds[id].c_str());
+        else
+        {
+            usersLock.lock();
+            map<string, string>::iterator it = users.find(names[id]);
+            ok = it != users.end() && it->second == passwds[id];
+            usersLock.unlock();
+        }
+        if (ok) a->ok ++ ;
+    }
+    return NULL;
+}
+
+static void* registerWorker(void* arg)
+{
+    bool useCache = *(bool*)arg;
+    char name[32];
+    for (int i = 0; i < WRITER_OPS; i ++ )
+    {
+        snprintf(name, sizeof(name), "new%d", i);
+        if (useCache) userCache::GetInstance()->Insert(name, "pw");
+        else
+        {
+            usersLock.lock();
+            users.insert(make_pair(string(name), string("pw")));
+            usersLock.unlock();
+        }
+    }
+    return NULL;
+}
+
+static double run(bool useCache)
+{
+    vector<pthread_t> tids(loginThreads);
+    vector<loginArg> args(loginThreads);
+    pthread_t writer;
+
+    uint64_t start = nowNs();
+    for (int i = 0; i < loginThreads; i ++ )
+    {
+        args[i].useCache = useCache;
+        args[i].seed = 88172645463325252ULL + i * 7919;
+        args[i].ok = 0;
+        pthread_create(&tids[i], NULL, loginWorker, &args[i]);
+    }
+    pthread_create(&writer, NULL, registerWorker, &useCache);
+    for (int i = 0; i < loginThreads; i ++ ) pthread_join(tids[i], NULL);
+    pthread_join(writer, NULL);
+    double seconds = (nowNs() - start) / 1e9;
+
+    for (int i = 0; i < loginThreads; i ++ )
+    {
+        if (args[i].ok != loginOps)
+        {
+            printf("%s: %ld of %d logins failed\n", useCache ? "userCache" : "map", loginOps - args[i].ok, loginOps);
+            exit(1);
+        }
+    }
+    return seconds;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1) userNum = atoi(argv[1]);
+    if (argc > 2) loginThreads = atoi(argv[2]);
+    if (argc > 3) loginOps = atoi(argv[3]);
+
+    names.resize(userNum);
+    passwds.resize(userNum);
+    char buf[32];
+    for (int i = 0; i < userNum; i ++ )
+    {
+        snprintf(buf, sizeof(buf), "user%07d", i);
+        names[i] = buf;
+        snprintf(buf, sizeof(buf), "pw%d", i * 31);
+        passwds[i] = buf;
+    }
+
+    uint64_t start = nowNs();
+    for (int i = 0; i < userNum; i ++ ) userCache::GetInstance()->Insert(names[i].c_str(), passwds[i].c_str());
+    double cacheLoad = (nowNs() - start) / 1e9;
+    start = nowNs();
+    for (int i = 0; i < userNum; i ++ ) users[names[i]] = passwds[i];
+    double mapLoad = (nowNs() - start) / 1e9;
+
+    printf("%d users, %d login threads x %d checks, 1 writer x %d inserts\n", userNum, loginThreads, loginOps, WRITER_OPS);
+    printf("%-10s %10s %10s %14s\n", "table", "load s", "run s", "checks/s");
+    double cacheRun = run(true);
+    printf("%-10s %10.2f %10.2f %14.0f\n", "userCache", cacheLoad, cacheRun, loginThreads * (double)loginOps / cacheRun);
+    double mapRun = run(false);
+    printf("%-10s %10.2f %10.2f %14.0f\n", "map+lock", mapLoad, mapRun, loginThreads * (double)loginOps / mapRun);
+    return 0;
+}
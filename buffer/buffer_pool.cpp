@@ -0,0 +1,75 @@
+#include "buffer_pool.h"
+
+bufferPool::~bufferPool()
+{
+    for (int n = 0; n < AFFINITY_NODE_MAX; n ++ )
+    {
+        for (int i = 0; i < BUFFER_CLASS_NUM; i ++ )
+        {
+            for (size_t j = 0; j < freeList[n][i].size(); j ++ ) free(freeList[n][i][j] - BUFFER_HEADER);
+            freeList[n][i].clear();
+        }
+    }
+}
+
+bufferPool* bufferPool::GetInstance()
+{
+    static bufferPool pool;
+    return &pool;
+}
+
+// 能容纳size字节的最小一档，超过最大一档返回-1
+int bufferPool::sizeClass(int size)
+{
+    int cls = 0;
+    int cap = BUFFER_MIN_SIZE;
+    while (cap < size)
+    {
+        cap <<= 1;
+        cls ++ ;
+    }
+    return cls < BUFFER_CLASS_NUM ? cls : -1;
+}
+
+// 借一块至少size字节的缓冲区，capacity返回实际大小
+char* bufferPool::Get(int size, int& capacity)
+{
+    int cls = sizeClass(size);
+    if (cls < 0) return NULL;
+    capacity = BUFFER_MIN_SIZE << cls;
+
+    int node = cpuAffinity::currentNode();
+    char* buf = NULL;
+    lock[node][cls].lock();
+    if (!freeList[node][cls].empty())
+    {
+        buf = freeList[node][cls].back();
+        freeList[node][cls].pop_back();
+    }
+    lock[node][cls].unlock();
+
+    if (!buf)
+    {
+        char* base = (char*)malloc(BUFFER_HEADER + capacity);
+        if (!base) return NULL;
+        buf = base + BUFFER_HEADER;
+        nodeOf(buf) = node;
+    }
+    return buf;
+}
+
+void bufferPool::Release(char* buf, int capacity)
+{
+    if (!buf) return;
+    int cls = sizeClass(capacity);
+    int node = nodeOf(buf);
+    lock[node][cls].lock();
+    if ((int)freeList[node][cls].size() * capacity < BUFFER_FREE_BYTES)
+    {
+        freeList[node][cls].push_back(buf);
+        buf = NULL;
+    }
+    lock[node][cls].unlock();
+
+    if (buf) free(buf - BUFFER_HEADER);
+}
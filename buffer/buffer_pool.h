@@ -0,0 +1,37 @@
+#pragma once
+
+
+#include <stdlib.h>
+#include <vector>
+#include "../lock/locker.h"
+#include "../affinity/cpu_affinity.h"
+
+using namespace std;
+
+static const int BUFFER_MIN_SIZE = 1024;            // 最小的一档
+static const int BUFFER_MAX_SIZE = 64 * 1024;       // 最大的一档，超过则申请失败
+static const int BUFFER_CLASS_NUM = 7;              // 1K, 2K, 4K, ... 64K
+static const int BUFFER_FREE_BYTES = 4 * 1024 * 1024;   // 每个节点每一档最多缓存的空闲字节数
+static const int BUFFER_HEADER = 16;                // 缓冲区前面记录申请时所在的节点，保持16字节对齐
+
+// 按2的幂分档的缓冲区池，连接只在处理请求期间借用读写缓冲区，空闲时归还
+// 每个NUMA节点每一档一个空闲链表和一把锁，空闲缓冲区超过BUFFER_FREE_BYTES时直接释放
+// 线程从自己所在节点的链表借，新申请的缓冲区由借用的线程首次写入，页面落在该线程的节点上
+// 连接会在反应堆和worker之间转手，归还时按缓冲区头部记录的节点放回原来的链表，不跟着归还的线程走
+class bufferPool
+{
+    private:
+        locker          lock[AFFINITY_NODE_MAX][BUFFER_CLASS_NUM];
+        vector<char*>   freeList[AFFINITY_NODE_MAX][BUFFER_CLASS_NUM];
+
+        bufferPool() {}
+        ~bufferPool();
+
+        static int      sizeClass(int size);
+        static int&     nodeOf(char* buf) { return *(int*)(buf - BUFFER_HEADER); }
+
+    public:
+        static bufferPool*  GetInstance();
+        char*               Get(int size, int& capacity);
+        void                Release(char* buf, int capacity);
+};
@@ -0,0 +1,243 @@
+#include "credential_cache.h"
+
+bloomFilter::bloomFilter()
+{
+    bits = 0;
+    hashes = 0;
+    words = NULL;
+}
+
+bloomFilter::~bloomFilter()
+{
+    delete[] words;
+}
+
+void bloomFilter::init(size_t _bits, int _hashes)
+{
+    bits = (_bits + 63) / 64 * 64;
+    hashes = _hashes;
+    words = new atomic<uint64_t>[bits / 64];
+    for (size_t i = 0; i < bits / 64; i ++ ) words[i].store(0, memory_order_relaxed);
+}
+
+// 双重散列：第i个位置取h1 + i * h2
+void bloomFilter::add(uint64_t hash)
+{
+    uint64_t h1 = hash & 0xffffffff, h2 = (hash >> 32) | 1;
+    for (int i = 0; i < hashes; i ++ )
+    {
+        size_t bit = (h1 + i * h2) % bits;
+        words[bit / 64].fetch_or(1ULL << (bit % 64), memory_order_relaxed);
+    }
+}
+
+bool bloomFilter::mayContain(uint64_t hash) const
+{
+    uint64_t h1 = hash & 0xffffffff, h2 = (hash >> 32) | 1;
+    for (int i = 0; i < hashes; i ++ )
+    {
+        size_t bit = (h1 + i * h2) % bits;
+        if (!(words[bit / 64].load(memory_order_relaxed) & (1ULL << (bit % 64)))) return false;
+    }
+    return true;
+}
+
+credentialCache::credentialCache()
+{
+    enabled = false;
+    shardCapacity = 0;
+    connPool = NULL;
+    bloomReady = false;
+    stopping = false;
+    loading = false;
+    closeLog = 0;
+}
+
+credentialCache::~credentialCache()
+{
+    stopping = true;
+    if (loading) pthread_join(loader, NULL);
+}
+
+credentialCache* credentialCache::GetInstance()
+{
+    static credentialCache cache;
+    return &cache;
+}
+
+uint64_t credentialCache::hashOf(const char* name)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *name; name ++ )
+    {
+        hash ^= (unsigned char)*name;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void credentialCache::init(connectionPool* _connPool, long capacity, int _closeLog)
+{
+    connPool = _connPool;
+    closeLog = _closeLog;
+    shardCapacity = capacity / CRED_SHARD_NUM > 0 ? capacity / CRED_SHARD_NUM : 1;
+    bloom.init(CRED_BLOOM_BITS, CRED_BLOOM_HASHES);
+    enabled = true;
+
+    loading = pthread_create(&loader, NULL, loadNames, this) == 0;
+    if (!loading) LOG_ERROR("%s", "credential cache: bloom filter loader not started");
+}
+
+void* credentialCache::loadNames(void* arg)
+{
+    mysql_thread_init();
+    ((credentialCache*)arg)->LoadNames();
+    mysql_thread_end();
+    return NULL;
+}
+
+// 取连接只等CRED_WAIT_MS，取不到就退避后重试，每次等待前后都检查stopping，关闭时不会卡在这里
+void credentialCache::LoadNames()
+{
+    int backoff = CRED_WAIT_MS;
+    while (!stopping)
+    {
+        MYSQL* mysql = NULL;
+        connectionRAII mysqlConn(&mysql, connPool, CRED_WAIT_MS);
+        if (mysql != NULL)
+        {
+            LoadRows(mysql);
+            return;
+        }
+
+        LOG_WARN("credential cache: no database connection, retry in %d ms", backoff);
+        for (int slept = 0; slept < backoff && !stopping; slept += 100) usleep(100 * 1000);
+        backoff = backoff * 2 < CRED_RETRY_MAX_MS ? backoff * 2 : CRED_RETRY_MAX_MS;
+    }
+}
+
+// 用mysql_use_result逐行读出用户名，不在客户端缓存整个结果集
+void credentialCache::LoadRows(MYSQL* mysql)
+{
+    if (mysql_query(mysql, "SELECT username FROM user"))
+    {
+        LOG_ERROR("credential cache: SELECT error:%s", mysql_error(mysql));
+        return;
+    }
+    MYSQL_RES* result = mysql_use_result(mysql);
+    if (result == NULL) return;
+
+    long count = 0;
+    while (MYSQL_ROW row = mysql_fetch_row(result))
+    {
+        if (stopping) break;
+        if (row[0]) bloom.add(hashOf(row[0]));
+        count ++ ;
+    }
+    mysql_free_result(result);
+    if (stopping) return;
+
+    // 加载期间注册的用户由Added写入过滤器，不会遗漏
+    bloomReady.store(true, memory_order_release);
+    LOG_INFO("credential cache: bloom filter ready, %ld users", count);
+}
+
+// 按用户名查一行，1为存在，0为不存在，-1为数据库不可用
+int credentialCache::Query(const char* name, string& passwd)
+{
+    MYSQL* mysql = NULL;
+    connectionRAII mysqlConn(&mysql, connPool, CRED_WAIT_MS);
+    if (mysql == NULL) return -1;
+
+    string param(name);
+    int ret = mysqlConn.QueryOne(STMT_USER_PASSWD, &param, 1, passwd);
+    if (ret < 0) LOG_ERROR("credential cache: query error:%s", mysql_error(mysql));
+    return ret;
+}
+
+int credentialCache::Lookup(const char* name, string& passwd)
+{
+    uint64_t hash = hashOf(name);
+    credShard& shard = shards[hash % CRED_SHARD_NUM];
+
+    shard.lock.lock();
+    unordered_map<string, list<credEntry>::iterator>::iterator it = shard.index.find(name);
+    if (it != shard.index.end())
+    {
+        list<credEntry>::iterator entry = it->second;
+        if (entry->found || entry->expire > coarseClock::now())
+        {
+            shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+            bool found = entry->found;
+            if (found) passwd = entry->passwd;
+            shard.lock.unlock();
+            return found;
+        }
+        shard.index.erase(it);
+        shard.lru.erase(entry);
+    }
+    shard.lock.unlock();
+
+    if (bloomReady.load(memory_order_acquire) && !bloom.mayContain(hash)) return 0;
+
+    int ret = Query(name, passwd);
+    if (ret >= 0) Put(name, passwd, ret == 1);
+    return ret;
+}
+
+// 查询期间同名用户可能刚注册成功，不存在的结果不覆盖已有的用户
+void credentialCache::Put(const char* name, const string& passwd, bool found)
+{
+    credShard& shard = shards[hashOf(name) % CRED_SHARD_NUM];
+
+    shard.lock.lock();
+    unordered_map<string, list<credEntry>::iterator>::iterator it = shard.index.find(name);
+    if (it != shard.index.end())
+    {
+        list<credEntry>::iterator entry = it->second;
+        if (found || !entry->found)
+        {
+            entry->passwd = passwd;
+            entry->found = found;
+            entry->expire = coarseClock::now() + CRED_NEGATIVE_TTL;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+        shard.lock.unlock();
+        return;
+    }
+
+    credEntry entry;
+    entry.name = name;
+    entry.passwd = found ? passwd : "";
+    entry.found = found;
+    entry.expire = coarseClock::now() + CRED_NEGATIVE_TTL;
+    shard.lru.push_front(entry);
+    shard.index[entry.name] = shard.lru.begin();
+
+    while (shard.lru.size() > shardCapacity)
+    {
+        shard.index.erase(shard.lru.back().name);
+        shard.lru.pop_back();
+    }
+    shard.lock.unlock();
+}
+
+int credentialCache::Check(const char* name, const char* passwd)
+{
+    string stored;
+    int ret = Lookup(name, stored);
+    if (ret <= 0) return ret;
+    return stored == passwd;
+}
+
+int credentialCache::Exists(const char* name)
+{
+    string stored;
+    return Lookup(name, stored);
+}
+
+void credentialCache::Added(const char* name, const char* passwd)
+{
+    bloom.add(hashOf(name));
+    Put(name, passwd, true);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+
+#include <time.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <mysql/mysql.h>
+#include "../lock/locker.h"
+#include "../clock/coarse_clock.h"
+#include "../log/log.h"
+#include "../CGImysql/sql_connection.h"
+
+using namespace std;
+
+const int CRED_SHARD_NUM = 16;                  // LRU分片数，每个分片一把锁
+const int CRED_NEGATIVE_TTL = 30;               // 不存在的用户缓存多少秒
+const size_t CRED_BLOOM_BITS = 1UL << 27;       // 布隆过滤器的位数，16MB，一千万用户时误判率约1%
+const int CRED_BLOOM_HASHES = 7;
+const int CRED_WAIT_MS = 1000;                  // 按需查询等待数据库连接的上限
+const int CRED_RETRY_MAX_MS = 8000;             // 加载用户名取不到连接时，重试间隔翻倍到这个上限为止
+
+// 只增不删的布隆过滤器，add和mayContain可以并发
+class bloomFilter
+{
+    private:
+        size_t                  bits;
+        int                     hashes;
+        atomic<uint64_t>*       words;
+
+    public:
+        bloomFilter();
+        ~bloomFilter();
+
+        void        init(size_t _bits, int _hashes);
+        void        add(uint64_t hash);
+        // 返回false时一定不存在
+        bool        mayContain(uint64_t hash) const;
+};
+
+// 按需查询的用户缓存，用于user表大到不适合启动时整张加载的情况
+// 未命中时用预处理语句按用户名查一行，结果放进容量有限的分片LRU，不存在的用户也缓存CRED_NEGATIVE_TTL秒
+// 启动后由后台线程流式读出所有用户名建立布隆过滤器，建好之后过滤器判定不存在的用户名不再查数据库
+// 启动时间与表的大小无关，建好过滤器之前只是少了这一层优化
+class credentialCache
+{
+    private:
+        struct credEntry
+        {
+            string      name;
+            string      passwd;
+            bool        found;
+            time_t      expire;         // 只对不存在的用户有效
+        };
+        struct credShard
+        {
+            locker                                          lock;
+            list<credEntry>                                 lru;        // 表头最近使用
+            unordered_map<string, list<credEntry>::iterator> index;
+        };
+
+        bool                enabled;
+        size_t              shardCapacity;
+        credShard           shards[CRED_SHARD_NUM];
+        connectionPool*     connPool;
+        bloomFilter         bloom;
+        atomic<bool>        bloomReady;
+        atomic<bool>        stopping;
+        pthread_t           loader;
+        bool                loading;
+
+        credentialCache();
+        ~credentialCache();
+
+        static uint64_t     hashOf(const char* name);
+        static void*        loadNames(void* arg);
+        void                LoadNames();
+        void                LoadRows(MYSQL* mysql);
+        int                 Query(const char* name, string& passwd);
+        int                 Lookup(const char* name, string& passwd);
+        void                Put(const char* name, const string& passwd, bool found);
+
+    public:
+        int                 closeLog;
+
+        static credentialCache* GetInstance();
+
+        void                init(connectionPool* _connPool, long capacity, int _closeLog);
+        bool                on() const { return enabled; }
+        // 以下返回值为1是、0否，-1表示数据库不可用
+        int                 Check(const char* name, const char* passwd);
+        int                 Exists(const char* name);
+        // 注册成功后调用
+        void                Added(const char* name, const char* passwd);
+};
@@ -0,0 +1,153 @@
+#include "file_cache.h"
+
+fileCache::fileCache()
+{
+    maxEntries = 1024;
+    maxBytes = 64 * 1024 * 1024;
+    mapLimit = 1024 * 1024;
+    curBytes = 0;
+}
+
+fileCache::~fileCache()
+{
+    lock.lock();
+    for (list<fileEntry*>::iterator it = lru.begin(); it != lru.end(); it ++ ) destroy(*it);
+    lru.clear();
+    files.clear();
+    lock.unlock();
+}
+
+fileCache* fileCache::GetInstance()
+{
+    static fileCache cache;
+    return &cache;
+}
+
+void fileCache::init(int _maxEntries, long _maxBytes, long _mapLimit)
+{
+    maxEntries = _maxEntries;
+    maxBytes = _maxBytes;
+    mapLimit = _mapLimit;
+}
+
+// 打开文件并建立共享映射，在锁外调用
+fileEntry* fileCache::openFile(const char* path, const struct stat& st)
+{
+    fileEntry* entry = new fileEntry;
+    entry->path = path;
+    entry->st = st;
+    entry->fd = -1;
+    entry->addr = NULL;
+    entry->refCount = 0;
+    entry->checkTime = coarseClock::now();
+    entry->stale = false;
+
+    if (S_ISREG(st.st_mode))
+    {
+        entry->fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (entry->fd < 0)
+        {
+            delete entry;
+            return NULL;
+        }
+        if (st.st_size > 0 && st.st_size <= mapLimit)
+        {
+            void* addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, entry->fd, 0);
+            if (addr != MAP_FAILED) entry->addr = (char*)addr;
+        }
+    }
+    return entry;
+}
+
+// 从索引和LRU中摘下，仍被引用的条目标记为stale，等引用释放后再销毁
+void fileCache::detach(fileEntry* entry)
+{
+    files.erase(entry->path);
+    lru.erase(entry->lruPos);
+    if (entry->addr) curBytes -= entry->st.st_size;
+    if (entry->refCount == 0) destroy(entry);
+    else entry->stale = true;
+}
+
+void fileCache::destroy(fileEntry* entry)
+{
+    if (entry->addr) munmap(entry->addr, entry->st.st_size);
+    if (entry->fd != -1) close(entry->fd);
+    delete entry;
+}
+
+// 超出条目数或字节数上限时从LRU尾部淘汰
+void fileCache::evict()
+{
+    while (!lru.empty() && ((int)files.size() > maxEntries || curBytes > maxBytes))
+    {
+        detach(lru.back());
+    }
+}
+
+// 取一个文件并增加引用计数，文件不存在时返回NULL
+// 命中且本秒内已检查过时不做任何系统调用
+fileEntry* fileCache::GetFile(const char* path, const struct stat* known)
+{
+    time_t now = coarseClock::now();
+    struct stat st;
+    if (known) st = *known;
+
+    lock.lock();
+    map<string, fileEntry*>::iterator it = files.find(path);
+    if (it != files.end())
+    {
+        fileEntry* entry = it->second;
+        bool valid = true;
+        if (known || entry->checkTime != now)
+        {
+            // 文件被修改、替换或删除后失效
+            entry->checkTime = now;
+            valid = (known || stat(path, &st) == 0) && st.st_mtime == entry->st.st_mtime
+                    && st.st_size == entry->st.st_size && st.st_ino == entry->st.st_ino;
+        }
+        if (valid)
+        {
+            entry->refCount ++ ;
+            lru.splice(lru.begin(), lru, entry->lruPos);
+            lock.unlock();
+            return entry;
+        }
+        detach(entry);
+    }
+    lock.unlock();
+
+    // 未命中，打开文件时不持有锁
+    if (!known && stat(path, &st) < 0) return NULL;
+    fileEntry* entry = openFile(path, st);
+    if (!entry) return NULL;
+
+    lock.lock();
+    it = files.find(path);
+    if (it != files.end())
+    {
+        // 其它线程已经先放进去了，用它的
+        fileEntry* other = it->second;
+        other->refCount ++ ;
+        lock.unlock();
+        destroy(entry);
+        return other;
+    }
+    if (entry->addr) curBytes += entry->st.st_size;
+    entry->refCount = 1;
+    lru.push_front(entry);
+    entry->lruPos = lru.begin();
+    files[entry->path] = entry;
+    evict();
+    lock.unlock();
+    return entry;
+}
+
+void fileCache::ReleaseFile(fileEntry* entry)
+{
+    if (!entry) return;
+    lock.lock();
+    entry->refCount -- ;
+    if (entry->stale && entry->refCount == 0) destroy(entry);
+    lock.unlock();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <map>
+#include <list>
+#include <string>
+#include "../lock/locker.h"
+#include "../clock/coarse_clock.h"
+
+using namespace std;
+
+// 缓存中的一个文件：打开的描述符、stat信息以及可选的只读共享映射
+struct fileEntry
+{
+    string                      path;
+    int                         fd;             // 只有普通文件才会打开
+    struct stat                 st;
+    char*                       addr;           // 文件不超过mapLimit时共享映射，否则为NULL
+    int                         refCount;       // 正在使用该文件的响应数
+    time_t                      checkTime;      // 上一次用stat检查mtime的时间
+    bool                        stale;          // 已经从缓存中摘下，最后一个引用释放时销毁
+    list<fileEntry*>::iterator  lruPos;
+};
+
+// 进程内共享的静态文件缓存，按解析后的路径索引
+// 每秒最多对同一文件做一次stat检查mtime，文件变化后旧条目在引用释放后销毁
+// 条目数和映射字节数超出上限时按LRU淘汰
+class fileCache
+{
+    private:
+        int                         maxEntries;
+        long                        maxBytes;       // 共享映射占用的字节数上限
+        long                        mapLimit;       // 超过该大小的文件只缓存描述符
+        long                        curBytes;
+        locker                      lock;
+        map<string, fileEntry*>     files;
+        list<fileEntry*>            lru;            // 表头最近使用
+
+        fileCache();
+        ~fileCache();
+
+        fileEntry*  openFile(const char* path, const struct stat& st);
+        void        detach(fileEntry* entry);
+        void        destroy(fileEntry* entry);
+        void        evict();
+
+    public:
+        static fileCache*   GetInstance();
+        void                init(int _maxEntries, long _maxBytes, long _mapLimit);
+        // 调用者刚stat过时传入known，用它校验和打开，不再重复stat
+        fileEntry*          GetFile(const char* path, const struct stat* known = NULL);
+        void                ReleaseFile(fileEntry* entry);
+};
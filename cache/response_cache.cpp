@@ -0,0 +1,161 @@
+#include "response_cache.h"
+
+responseCache::responseCache()
+{
+    fileLimit = 64 * 1024;
+    maxBytes = 32 * 1024 * 1024;
+    curBytes = 0;
+}
+
+responseCache::~responseCache()
+{
+    lock.lock();
+    for (list<responseEntry*>::iterator it = lru.begin(); it != lru.end(); it ++ ) destroy(*it);
+    lru.clear();
+    responses.clear();
+    lock.unlock();
+}
+
+responseCache* responseCache::GetInstance()
+{
+    static responseCache cache;
+    return &cache;
+}
+
+void responseCache::init(long _fileLimit, long _maxBytes)
+{
+    fileLimit = _fileLimit;
+    maxBytes = _maxBytes;
+}
+
+// 读出文件并拼好两个版本的响应，在锁外调用
+// 头部格式与httpConnection::processWrite(FILE_REQUEST)生成的一致
+responseEntry* responseCache::build(const char* path, const struct stat& st)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    responseEntry* entry = new responseEntry;
+    entry->path = path;
+    entry->st = st;
+    entry->bytes = 0;
+    entry->refCount = 0;
+    entry->checkTime = coarseClock::now();
+    entry->stale = false;
+
+    const char* connection[2] = {"close", "keep-alive"};
+    for (int i = 0; i < 2; i ++ )
+    {
+        char head[128];
+        int headLen = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length:%ld\r\nConnection:%s\r\n\r\n",
+                               (long)st.st_size, connection[i]);
+        entry->len[i] = headLen + st.st_size;
+        entry->data[i] = new char[entry->len[i]];
+        memcpy(entry->data[i], head, headLen);
+        entry->bytes += entry->len[i];
+    }
+
+    // 只读一次文件，第二份直接拷贝
+    long got = 0;
+    int headLen = entry->len[0] - st.st_size;
+    while (got < st.st_size)
+    {
+        int ret = pread(fd, entry->data[0] + headLen + got, st.st_size - got, got);
+        if (ret <= 0) break;
+        got += ret;
+    }
+    close(fd);
+    if (got != st.st_size)
+    {
+        destroy(entry);
+        return NULL;
+    }
+    memcpy(entry->data[1] + entry->len[1] - st.st_size, entry->data[0] + headLen, st.st_size);
+    return entry;
+}
+
+// 从索引和LRU中摘下，仍被引用的条目标记为stale，等引用释放后再销毁
+void responseCache::detach(responseEntry* entry)
+{
+    responses.erase(entry->path);
+    lru.erase(entry->lruPos);
+    curBytes -= entry->bytes;
+    if (entry->refCount == 0) destroy(entry);
+    else entry->stale = true;
+}
+
+void responseCache::destroy(responseEntry* entry)
+{
+    delete[] entry->data[0];
+    delete[] entry->data[1];
+    delete entry;
+}
+
+// 取一个文件的完整响应并增加引用计数
+// 文件不存在、不是普通文件、为空或超过fileLimit时返回NULL，由调用者走普通路径
+responseEntry* responseCache::GetResponse(const char* path, struct stat& st, int& statRet)
+{
+    time_t now = coarseClock::now();
+    statRet = 0;
+
+    lock.lock();
+    map<string, responseEntry*>::iterator it = responses.find(path);
+    if (it != responses.end())
+    {
+        responseEntry* entry = it->second;
+        bool valid = true;
+        if (entry->checkTime != now)
+        {
+            // 文件被修改、替换或删除后重新构建
+            entry->checkTime = now;
+            statRet = stat(path, &st) == 0 ? 1 : -1;
+            valid = statRet == 1 && st.st_mtime == entry->st.st_mtime
+                    && st.st_size == entry->st.st_size && st.st_ino == entry->st.st_ino;
+        }
+        if (valid)
+        {
+            entry->refCount ++ ;
+            lru.splice(lru.begin(), lru, entry->lruPos);
+            lock.unlock();
+            return entry;
+        }
+        detach(entry);
+    }
+    lock.unlock();
+
+    // 未命中，读文件时不持有锁；超过fileLimit的文件和不存在的路径也只stat这一次
+    if (statRet == 0) statRet = stat(path, &st) == 0 ? 1 : -1;
+    if (statRet < 0) return NULL;
+    if (!S_ISREG(st.st_mode) || st.st_size == 0 || st.st_size > fileLimit) return NULL;
+    responseEntry* entry = build(path, st);
+    if (!entry) return NULL;
+
+    lock.lock();
+    it = responses.find(path);
+    if (it != responses.end())
+    {
+        // 其它线程已经先放进去了，用它的
+        responseEntry* other = it->second;
+        other->refCount ++ ;
+        lock.unlock();
+        destroy(entry);
+        return other;
+    }
+    entry->refCount = 1;
+    lru.push_front(entry);
+    entry->lruPos = lru.begin();
+    responses[entry->path] = entry;
+    curBytes += entry->bytes;
+    while (!lru.empty() && curBytes > maxBytes) detach(lru.back());
+    lock.unlock();
+    return entry;
+}
+
+void responseCache::ReleaseResponse(responseEntry* entry)
+{
+    if (!entry) return;
+    lock.lock();
+    entry->refCount -- ;
+    if (entry->stale && entry->refCount == 0) destroy(entry);
+    lock.unlock();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <map>
+#include <list>
+#include <string>
+#include "../lock/locker.h"
+#include "../clock/coarse_clock.h"
+
+using namespace std;
+
+// 预先序列化好的完整响应（状态行 + 头部 + 文件内容），分keep-alive和close两个版本
+// 构建后只读，多个连接共享同一块内存
+struct responseEntry
+{
+    string                          path;
+    struct stat                     st;
+    char*                           data[2];        // 下标为linger，0为Connection:close，1为keep-alive
+    int                             len[2];
+    long                            bytes;          // 两个版本共占用的字节数
+    int                             refCount;
+    time_t                          checkTime;      // 上一次用stat检查mtime的时间
+    bool                            stale;          // 已经从缓存中摘下，最后一个引用释放时销毁
+    list<responseEntry*>::iterator  lruPos;
+};
+
+// 小文件的完整响应缓存，按解析后的路径索引
+// 只缓存不超过fileLimit的普通文件；每秒最多检查一次mtime，文件变化后重新构建
+// 总字节数超过maxBytes时按LRU淘汰
+class responseCache
+{
+    private:
+        long                            fileLimit;
+        long                            maxBytes;
+        long                            curBytes;
+        locker                          lock;
+        map<string, responseEntry*>     responses;
+        list<responseEntry*>            lru;            // 表头最近使用
+
+        responseCache();
+        ~responseCache();
+
+        responseEntry*  build(const char* path, const struct stat& st);
+        void            detach(responseEntry* entry);
+        void            destroy(responseEntry* entry);
+
+    public:
+        static responseCache*   GetInstance();
+        void                    init(long _fileLimit, long _maxBytes);
+        // 未命中时st和statRet把查过的文件状态交给调用者，普通路径不必再stat一次
+        // statRet为1表示st有效，-1表示文件不存在，0表示没有stat
+        responseEntry*          GetResponse(const char* path, struct stat& st, int& statRet);
+        void                    ReleaseResponse(responseEntry* entry);
+};
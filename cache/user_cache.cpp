@@ -0,0 +1,140 @@
+#include "user_cache.h"
+
+userCache::userCache()
+{
+    for (int i = 0; i < USER_SHARD_NUM; i ++ )
+    {
+        shards[i].table.store(newTable(USER_TABLE_INIT), memory_order_relaxed);
+        shards[i].count = 0;
+    }
+}
+
+userCache::~userCache()
+{
+    for (int i = 0; i < USER_SHARD_NUM; i ++ )
+    {
+        userTable* table = shards[i].table.load(memory_order_relaxed);
+        for (size_t j = 0; j <= table->mask; j ++ ) free(table->slots[j].load(memory_order_relaxed));
+        shards[i].retired.push_back(table);
+        for (size_t j = 0; j < shards[i].retired.size(); j ++ )
+        {
+            delete[] shards[i].retired[j]->slots;
+            delete shards[i].retired[j];
+        }
+    }
+}
+
+userCache* userCache::GetInstance()
+{
+    static userCache cache;
+    return &cache;
+}
+
+// FNV-1a，高位选分片，低位选槽
+uint64_t userCache::hashOf(const char* name, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i ++ )
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+userTable* userCache::newTable(size_t size)
+{
+    userTable* table = new userTable;
+    table->mask = size - 1;
+    table->slots = new atomic<userEntry*>[size];
+    for (size_t i = 0; i < size; i ++ ) table->slots[i].store(NULL, memory_order_relaxed);
+    return table;
+}
+
+// 放到第一个空槽，调用前已确认不存在同名条目
+void userCache::place(userTable* table, userEntry* entry)
+{
+    size_t i = entry->hash & table->mask;
+    while (table->slots[i].load(memory_order_relaxed)) i = (i + 1) & table->mask;
+    table->slots[i].store(entry, memory_order_release);
+}
+
+const userEntry* userCache::find(const userShard& shard, const char* name, size_t len, uint64_t hash) const
+{
+    const userTable* table = shard.table.load(memory_order_acquire);
+    for (size_t i = hash & table->mask; ; i = (i + 1) & table->mask)
+    {
+        const userEntry* entry = table->slots[i].load(memory_order_acquire);
+        if (entry == NULL) return NULL;
+        if (entry->hash == hash && entry->nameLen == (int)len && memcmp(entry->name(), name, len) == 0) return entry;
+    }
+}
+
+bool userCache::Insert(const char* name, const char* passwd)
+{
+    size_t len = strlen(name);
+    size_t passwdLen = strlen(passwd);
+    uint64_t hash = hashOf(name, len);
+    userShard& shard = shards[hash >> (64 - USER_SHARD_BITS)];
+
+    shard.lock.lock();
+    if (find(shard, name, len, hash))
+    {
+        shard.lock.unlock();
+        return false;
+    }
+
+    userTable* table = shard.table.load(memory_order_relaxed);
+    if ((shard.count + 1) * 2 > table->mask + 1)
+    {
+        // 新表填好后才发布，读者看到的总是完整的表
+        userTable* bigger = newTable((table->mask + 1) * 2);
+        for (size_t i = 0; i <= table->mask; i ++ )
+        {
+            userEntry* old = table->slots[i].load(memory_order_relaxed);
+            if (old) place(bigger, old);
+        }
+        shard.table.store(bigger, memory_order_release);
+        shard.retired.push_back(table);
+        table = bigger;
+    }
+
+    userEntry* entry = (userEntry*)malloc(sizeof(userEntry) + len + passwdLen + 1);
+    entry->hash = hash;
+    entry->nameLen = len;
+    entry->passwdLen = passwdLen;
+    memcpy(entry->data, name, len + 1);
+    memcpy(entry->data + len + 1, passwd, passwdLen + 1);
+    place(table, entry);
+    shard.count ++ ;
+    shard.lock.unlock();
+    return true;
+}
+
+bool userCache::Contains(const char* name) const
+{
+    size_t len = strlen(name);
+    uint64_t hash = hashOf(name, len);
+    return find(shards[hash >> (64 - USER_SHARD_BITS)], name, len, hash) != NULL;
+}
+
+bool userCache::Check(const char* name, const char* passwd) const
+{
+    size_t len = strlen(name);
+    uint64_t hash = hashOf(name, len);
+    const userEntry* entry = find(shards[hash >> (64 - USER_SHARD_BITS)], name, len, hash);
+    return entry && strcmp(entry->passwd(), passwd) == 0;
+}
+
+size_t userCache::Size()
+{
+    size_t size = 0;
+    for (int i = 0; i < USER_SHARD_NUM; i ++ )
+    {
+        // 只用于统计，不要求精确
+        shards[i].lock.lock();
+        size += shards[i].count;
+        shards[i].lock.unlock();
+    }
+    return size;
+}
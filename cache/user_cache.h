@@ -0,0 +1,70 @@
+#pragma once
+
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <atomic>
+#include <vector>
+#include "../lock/locker.h"
+
+using namespace std;
+
+const int USER_SHARD_BITS = 6;                          // 分片数为2的USER_SHARD_BITS次方
+const int USER_SHARD_NUM = 1 << USER_SHARD_BITS;
+const size_t USER_TABLE_INIT = 64;                      // 每个分片初始的槽数
+
+// 一个用户的用户名和密码，插入后不再修改，整块分配：name\0passwd\0
+struct userEntry
+{
+    uint64_t        hash;
+    int             nameLen;
+    int             passwdLen;
+    char            data[1];
+
+    const char*     name() const { return data; }
+    const char*     passwd() const { return data + nameLen + 1; }
+};
+
+// 开放寻址的槽数组，装载率不超过一半，线性探测总能遇到空槽
+struct userTable
+{
+    size_t                      mask;
+    atomic<userEntry*>*         slots;
+};
+
+// 分片的并发用户表，代替原来由全局锁保护的map<string, string>
+// 读不加锁：槽里是指向不可变条目的原子指针，按acquire读取；写者只锁自己的分片
+// 扩容时建好新表再整体发布，旧表可能仍有读者在用，放到retired中等销毁时一起释放
+// 用户只增不删，所以条目本身不需要回收
+class userCache
+{
+    private:
+        struct alignas(64) userShard
+        {
+            atomic<userTable*>      table;
+            locker                  lock;
+            size_t                  count;
+            vector<userTable*>      retired;
+        };
+
+        userShard           shards[USER_SHARD_NUM];
+
+        userCache();
+        ~userCache();
+
+        static uint64_t     hashOf(const char* name, size_t len);
+        static userTable*   newTable(size_t size);
+        static void         place(userTable* table, userEntry* entry);
+        const userEntry*    find(const userShard& shard, const char* name, size_t len, uint64_t hash) const;
+
+    public:
+        static userCache*   GetInstance();
+
+        // 用户名已存在时返回false，不覆盖原来的密码
+        bool                Insert(const char* name, const char* passwd);
+        bool                Contains(const char* name) const;
+        // 用户存在且密码一致
+        bool                Check(const char* name, const char* passwd) const;
+        size_t              Size();
+};
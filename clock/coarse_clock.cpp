@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <string.h>
+#include "coarse_clock.h"
+
+atomic<uint64_t>    coarseClock::mono(0);
+atomic<uint64_t>    coarseClock::wall(0);
+atomic<bool>        coarseClock::loopDriven(false);
+atomic<unsigned>    coarseClock::seq(0);
+atomic<time_t>      coarseClock::second(-1);
+atomic<int>         coarseClock::mday(0);
+atomic_flag         coarseClock::formatting = ATOMIC_FLAG_INIT;
+char                coarseClock::logDate[CLOCK_LOG_DATE_LEN + 1];
+char                coarseClock::httpDate[CLOCK_HTTP_DATE_LEN + 1];
+
+// 进程启动时先读一次，保证第一次事件循环之前读到的时间和日期前缀有效
+static struct clockInit
+{
+    clockInit() { coarseClock::update(); }
+} clockInitOnce;
+
+void coarseClock::update()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    mono.store((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000, memory_order_relaxed);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    wall.store((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000, memory_order_relaxed);
+
+    if (ts.tv_sec != second.load(memory_order_relaxed)) format(ts.tv_sec);
+}
+
+void coarseClock::format(time_t sec)
+{
+    // 别的线程正在格式化时直接返回，读者最多多用一会儿上一秒的结果
+    if (formatting.test_and_set(memory_order_acquire)) return;
+
+    struct tm local, gmt;
+    localtime_r(&sec, &local);
+    gmtime_r(&sec, &gmt);
+    char logBuf[64], httpBuf[32];      // 年份是不限长的%d，按最长的输出留够空间
+    snprintf(logBuf, sizeof(logBuf), "%d-%02d-%02d %02d:%02d:%02d",
+             local.tm_year + 1900, local.tm_mon + 1, local.tm_mday,
+             local.tm_hour, local.tm_min, local.tm_sec);
+    strftime(httpBuf, sizeof(httpBuf), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+
+    seq.fetch_add(1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(logDate, logBuf, CLOCK_LOG_DATE_LEN);
+    memcpy(httpDate, httpBuf, CLOCK_HTTP_DATE_LEN);
+    mday.store(local.tm_mday, memory_order_relaxed);
+    second.store(sec, memory_order_relaxed);
+    seq.fetch_add(1, memory_order_release);
+
+    formatting.clear(memory_order_release);
+}
+
+time_t coarseClock::copyDate(const char* src, int len, char* out)
+{
+    unsigned s;
+    time_t sec;
+    do
+    {
+        s = seq.load(memory_order_acquire);
+        if (s & 1) continue;
+        memcpy(out, src, len);
+        sec = second.load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((s & 1) || seq.load(memory_order_relaxed) != s);
+    return sec;
+}
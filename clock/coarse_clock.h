@@ -0,0 +1,49 @@
+#pragma once
+
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+
+using namespace std;
+
+static const int CLOCK_LOG_DATE_LEN = 19;      // 日志时间前缀"2026-10-18 03:30:03"的长度，本地时间
+static const int CLOCK_HTTP_DATE_LEN = 29;     // Date头"Sun, 18 Oct 2026 03:30:03 GMT"的长度
+
+// 进程内共享的粗粒度时钟
+// 反应堆每次从epoll_wait/io_uring_enter返回时调用update()，空闲时也至少每tickMs被timerfd唤醒一次，
+// 所以读到的时间最多落后一个tickMs；定时器、缓存、日志读时钟都只是几次原子读，不再各自调用time/clock_gettime
+// 秒数变化时由调用update()的线程做一次localtime/gmtime并格式化日志前缀和Date头，同一秒内直接复用
+// 格式化好的字符串用序号锁发布，读者拷贝后发现序号变了就重读
+class coarseClock
+{
+    private:
+        static atomic<uint64_t>     mono;           // 单调时钟的毫秒数
+        static atomic<uint64_t>     wall;           // 墙上时间的微秒数
+        static atomic<bool>         loopDriven;     // 事件循环正在运行并负责更新
+        static atomic<unsigned>     seq;            // 奇数表示正在改写下面的格式化结果
+        static atomic<time_t>       second;         // 格式化结果对应的秒
+        static atomic<int>          mday;           // 本地时间的日，日志按天分文件用
+        static atomic_flag          formatting;     // 多个反应堆同时跨秒时只让一个去格式化
+        static char                 logDate[CLOCK_LOG_DATE_LEN + 1];
+        static char                 httpDate[CLOCK_HTTP_DATE_LEN + 1];
+
+        static void         format(time_t sec);
+        static time_t       copyDate(const char* src, int len, char* out);
+
+    public:
+        // 读两次时钟，跨秒时格式化一次
+        static void         update();
+        // 事件循环没有运行时（启动阶段、退出之后）由读者自己更新
+        static void         refresh() { if (!loopDriven.load(memory_order_relaxed)) update(); }
+        static void         setLoopDriven(bool on) { loopDriven.store(on, memory_order_relaxed); if (on) update(); }
+
+        static uint64_t     nowMs() { return mono.load(memory_order_relaxed); }
+        static uint64_t     nowUs() { return wall.load(memory_order_relaxed); }
+        static time_t       now() { return (time_t)(nowUs() / 1000000); }
+        static int          today() { return mday.load(memory_order_relaxed); }
+
+        // 拷贝最近一秒的格式化结果（不带结尾的'\0'），返回它对应的秒，可能比now()早一秒
+        static time_t       copyLogDate(char* out) { return copyDate(logDate, CLOCK_LOG_DATE_LEN, out); }
+        static time_t       copyHttpDate(char* out) { return copyDate(httpDate, CLOCK_HTTP_DATE_LEN, out); }
+};
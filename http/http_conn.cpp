@@ -12,35 +12,13 @@ const char* error404Title = "Not Found";
 const char* error404Form = "The requested file was not found on this server.\n";
 const char* error500Title = "Internal Error";
 const char* error500Form = "There was an unusual problem serving the requested file.\n";
+const char* error503Title = "Service Unavailable";
+const char* error503Form = "The server is temporarily unable to service your request, please try again later.\n";
 
-locker lock;
-map<string, string> users;
-
-void httpConnection::initMysqlResult(connectionPool* connPool)
-{
-    // 从连接池中取一个连接
-    MYSQL* mysql = NULL;
-    connectionRAII mysqlCon(&mysql, connPool);
-
-    // 在user表中检索username，passwd数据，查询成功返回0
-    if (mysql_query(mysql, "SELECT username, passwd FROM user"))
-    {
-        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
-    }
-    // 从表中检索完整的结果集
-    MYSQL_RES* result = mysql_store_result(mysql);
-    // 返回结果集中的列数
-    int numFields = mysql_num_fields(result);
-    // 返回所有字段结构的数组
-    MYSQL_FIELD* fields = mysql_fetch_fields(result);
-    // 从结果集中获取下一行，将对应的用户名和密码，存入map中
-    while (MYSQL_ROW row = mysql_fetch_row(result))
-    {
-        string s1(row[0]);
-        string s2(row[1]);
-        users[s1] = s2;
-    }
-}
+locker lock;                    // 只保护registering，users读写由userCache自己处理
+set<string> registering;        // 注册语句还在执行中的用户名，防止同名并发注册
+userStore* httpConnection::store = NULL;
+void (*httpConnection::resume)(httpConnection* conn) = NULL;
 
 // 对文件描述符设置非阻塞
 void setNonBlocking(int fd)
@@ -80,8 +58,11 @@ void modFd(int epollFd, int fd, int ev, int TRIGMode)
     epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &events);
 }
 
-int httpConnection::userCount = 0;
-int httpConnection::epollFd = -1;
+std::atomic<int> httpConnection::userCount(0);
+void (*httpConnection::notify)(httpConnection* conn, int ev) = NULL;
+int httpConnection::fileSendMode = 0;
+int httpConnection::useFileCache = 0;
+int httpConnection::useResponseCache = 0;
 
 // 关闭连接，关闭一个连接，客户总量减一
 void httpConnection::closeConnection(bool realClose)
@@ -92,28 +73,41 @@ void httpConnection::closeConnection(bool realClose)
         removeFd(epollFd, sockfd);
         sockfd = -1;
         userCount--;
+        releaseBuffers();
     }
 }
 
+// 反应堆关闭连接时在close之前调用：作废还在异步写入中的注册，结果回来时直接丢弃，不再碰这个槽位
+// 然后归还缓冲区、排队的响应、文件映射和缓存引用，空闲的槽位不占内存，也不挡住过期缓存项的销毁
+void httpConnection::onClose()
+{
+    dbTicket ++ ;
+    releaseBuffers();
+}
+
 // 初始化连接，外部调用初始化套接字地址
-void httpConnection::init(int _sockfd, const sockaddr_in& _addr, char* _root, int _TRIGMode, 
+// 多反应堆模式下每个连接注册到接受它的那个反应堆的epoll实例上
+void httpConnection::init(int _epollFd, int _sockfd, const sockaddr_in& _addr, char* _root, int _TRIGMode, 
                           int _closeLog, string _user, string _passwd, string _sqlName)
 {
+    epollFd = _epollFd;
     sockfd = _sockfd;
     address = _addr;
 
-    addFd(epollFd, _sockfd, true, TRIGMode); // 默认注册EPOLLONESHOT事件
-    userCount++;
-
     // 当浏览器出现连接重置时，可能是网站根目录出错或者http格式出错或者访问的文件中内容完全为空
     docRoot = _root;
     TRIGMode = _TRIGMode;
     closeLog = _closeLog;
 
+    // 默认注册EPOLLONESHOT事件，io_uring后端没有epoll实例
+    if (epollFd >= 0) addFd(epollFd, _sockfd, true, TRIGMode);
+    userCount++;
+
     strcpy(sqlUser, _user.c_str());
     strcpy(sqlPasswd, _passwd.c_str());
     strcpy(sqlName, _sqlName.c_str());
 
+    // 上一个使用这个槽位的连接可能在发送途中被关闭，init会释放它留下的映射、文件和缓冲区
     init();
 }
 
@@ -121,9 +115,6 @@ void httpConnection::init(int _sockfd, const sockaddr_in& _addr, char* _root, in
 // checkState默认是CHECK_STATE_REQUESTLINE，分析请求行状态
 void httpConnection::init()
 {
-    mysql = NULL;
-    bytesHaveSend = 0;
-    bytesToSend = 0;
     checkState = CHECK_STATE_REQUESTLINE;
     linger = false;
     method = GET;
@@ -133,33 +124,129 @@ void httpConnection::init()
     host = 0;
     startLine = 0;
     checkedIdx = 0;
+    requestStart = 0;
     readIdx = 0;
-    writeIdx = 0;
     cgi = 0;
+    headers.clear();
+    memset(headerIndex, 0, sizeof(headerIndex));
     state = 0;
-    timerFlag = 0;
-    improv = 0;
+    dbState = DB_IDLE;
+    dbTicket ++ ;
 
-    memset(readBuf, '\0', READ_BUFFER_SIZE);
-    memset(writeBuf, '\0', WRITE_BUFFER_SIZE);
+    // 读写缓冲区在下一个请求到来时再借
+    releaseBuffers();
     memset(realFile, '\0', FILENAME_LEN);
 }
 
+// 当前请求已经生成响应，解析位置移到流水线上的下一个请求，缓冲区里的数据保留
+void httpConnection::nextRequest()
+{
+    long end = checkedIdx;
+    if (checkState == CHECK_STATE_CONTENT) end += contentLength;
+
+    checkState = CHECK_STATE_REQUESTLINE;
+    linger = false;
+    method = GET;
+    url = 0;
+    version = 0;
+    contentLength = 0;
+    host = 0;
+    cgi = 0;
+    headers.clear();
+    memset(headerIndex, 0, sizeof(headerIndex));
+    startLine = checkedIdx = requestStart = end;
+    memset(realFile, '\0', FILENAME_LEN);
+}
+
+// 丢掉已经处理完的请求，把后面未处理的数据移到readBuf开头
+// 后一个请求可能已经解析了一半，指向readBuf的字段一起平移
+void httpConnection::compactRead()
+{
+    if (requestStart == 0) return;
+    long start = requestStart;
+    memmove(readBuf, readBuf + start, readIdx - start);
+    readIdx -= start;
+    checkedIdx -= start;
+    startLine -= start;
+    requestStart = 0;
+    if (url) url -= start;
+    if (version) version -= start;
+    if (host) host -= start;
+}
+
+// 把读写缓冲区还给bufferPool，排队响应的头部在writeBuf中，一并释放
+void httpConnection::releaseBuffers()
+{
+    unmap();
+    releaseResponses();
+    bufferPool::GetInstance()->Release(readBuf, readBufSize);
+    bufferPool::GetInstance()->Release(writeBuf, writeBufSize);
+    readBuf = NULL;
+    readBufSize = 0;
+    writeBuf = NULL;
+    writeBufSize = 0;
+}
+
+// 保证readBuf的容量不小于size，不够时换更大的一档并拷贝已读入的数据
+// 超过bufferPool最大的一档时返回false
+bool httpConnection::reserveRead(int size)
+{
+    if (size <= readBufSize) return true;
+    int capacity = 0;
+    char* buf = bufferPool::GetInstance()->Get(size, capacity);
+    if (!buf) return false;
+
+    if (readBuf)
+    {
+        memcpy(buf, readBuf, readIdx);
+        // 已经解析出的字段指向旧缓冲区，按偏移搬到新缓冲区
+        if (url) url = buf + (url - readBuf);
+        if (version) version = buf + (version - readBuf);
+        if (host) host = buf + (host - readBuf);
+        bufferPool::GetInstance()->Release(readBuf, readBufSize);
+    }
+    readBuf = buf;
+    readBufSize = capacity;
+    return true;
+}
+
+// 保证writeBuf的容量不小于size
+bool httpConnection::reserveWrite(int size)
+{
+    if (size <= writeBufSize) return true;
+    int capacity = 0;
+    char* buf = bufferPool::GetInstance()->Get(size, capacity);
+    if (!buf) return false;
+
+    if (writeBuf)
+    {
+        memcpy(buf, writeBuf, writeIdx);
+        bufferPool::GetInstance()->Release(writeBuf, writeBufSize);
+    }
+    writeBuf = buf;
+    writeBufSize = capacity;
+    return true;
+}
+
 // 从状态机，用于解析出一行内容
+// 用httpScanner一次比较16/32个字节查找'\r'和'\n'
 // 返回值为行的读取状态，有LINE_OK, LINE_BAD, LINE_OPEN
 httpConnection::LINE_STATUS httpConnection::parseLine()
 {
     char temp;
     for (; checkedIdx < readIdx; checkedIdx ++ )
     {
+        // 一次跳过一整段普通字符，直接停在下一个'\r'或'\n'上
+        checkedIdx = httpScanner::findLineEnd(readBuf + checkedIdx, readBuf + readIdx) - readBuf;
+        if (checkedIdx == readIdx) return LINE_OPEN;
         temp = readBuf[checkedIdx];
         if (temp == '\r')
         {
             if ((checkedIdx + 1) == readIdx) return LINE_OPEN;  // 还未读到一个完整的行
             else if (readBuf[checkedIdx + 1] == '\n')   // 如果下一个字符是'\n'，则说明读到了一个完整的行
             {
-                readBuf[checkedIdx ++ ] == '\0';
-                readBuf[checkedIdx ++ ] == '\0';
+                readBuf[checkedIdx ++ ] = '\0';
+                readBuf[checkedIdx ++ ] = '\0';
                 // 替换'\r\n'为'\0\0'，返回LINE_OK
                 return LINE_OK;
             }
@@ -179,19 +266,76 @@ httpConnection::LINE_STATUS httpConnection::parseLine()
     return LINE_OPEN;
 }
 
+// 读一次套接字，readBuf之外再附带一块栈上的缓冲区
+// 数据超出readBuf剩余空间时才扩容，一次系统调用就能读完，返回值同read
+int httpConnection::readSome()
+{
+    if (readIdx + 1 >= readBufSize && !reserveRead(readBufSize ? readBufSize * 2 : READ_BUFFER_SIZE))
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    char extra[READ_EXTRA_SIZE];
+    struct iovec vec[2];
+    vec[0].iov_base = readBuf + readIdx;
+    vec[0].iov_len = readBufSize - 1 - readIdx;
+    vec[1].iov_base = extra;
+    vec[1].iov_len = READ_EXTRA_SIZE;
+
+    int readBytes = readv(sockfd, vec, 2);
+    if (readBytes <= 0) return readBytes;
+    if (readBytes <= (int)vec[0].iov_len)
+    {
+        readIdx += readBytes;
+        return readBytes;
+    }
+
+    int over = readBytes - vec[0].iov_len;
+    readIdx += vec[0].iov_len;
+    if (!reserveRead(readIdx + over + 1))
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+    memcpy(readBuf + readIdx, extra, over);
+    readIdx += over;
+    return readBytes;
+}
+
+// 看缓冲区里当前请求的请求行判断是否要访问数据库：POST且url最后一段以2或3开头(登录、注册)，与doRequest的判断一致
+// 线程池据此把请求放进数据库通道，请求行还没收全时按静态请求处理
+bool httpConnection::dbBound() const
+{
+    if (!readBuf) return false;
+    const char* p = readBuf + requestStart;
+    const char* end = readBuf + readIdx;
+    if (end - p < 5 || strncasecmp(p, "POST", 4) != 0 || (p[4] != ' ' && p[4] != '\t')) return false;
+
+    p += 5;
+    while (p < end && (*p == ' ' || *p == '\t')) p ++ ;
+    const char* urlEnd = httpScanner::findSpace(p, end);
+    if (urlEnd == end) return false;
+
+    const char* slash = NULL;
+    for (const char* q = p; q < urlEnd; q ++ )
+    {
+        if (*q == '/') slash = q;
+    }
+    return slash && slash + 1 < urlEnd && (slash[1] == '2' || slash[1] == '3');
+}
+
 // 循环读取客户端数据，直到无数据可读或对方关闭连接
 // 非阻塞ET工作模式下，需要一次性将数据读完
+// 请求超过bufferPool最大的一档时返回false
 bool httpConnection::readOnce()
 {
-    if (readIdx >= READ_BUFFER_SIZE) return false;
     int readBytes = 0;
 
     // ET模式下，需要一次性将数据读完
     if (TRIGMode == 1)
     {
-        readBytes = read(sockfd, readBuf + readIdx, READ_BUFFER_SIZE - readIdx);
-        // 读取数据到readBuf + readIdx位置，最多读取READ_BUFFER_SIZE - readIdx个字节
-        readIdx += readBytes;
+        readBytes = readSome();
         if (readBytes <= 0) return false;
         return true;
     }
@@ -201,29 +345,39 @@ bool httpConnection::readOnce()
     {
         while (true)
         {
-            readBytes = read(sockfd, readBuf + readIdx, READ_BUFFER_SIZE - readIdx);
+            readBytes = readSome();
             if (readBytes == -1)
             {
                 if (errno == EAGAIN || errno == EWOULDBLOCK) break;
                 return false;
             }
             else if (readBytes == 0) return false;
-            readIdx += readBytes;
         }
         return true;
     }
 }
 
+// io_uring后端：数据已经由内核收进提供的缓冲区，这里只做拷贝
+bool httpConnection::recvData(const char* data, int len)
+{
+    if (!reserveRead(readIdx + len + 1)) return false;
+    memcpy(readBuf + readIdx, data, len);
+    readIdx += len;
+    return true;
+}
+
 // 解析HTTP请求行，获得请求方法，目标URL，以及HTTP版本号
 // 以"GET /index.html HTTP/1.1"为例
 httpConnection::HTTP_CODE httpConnection::parseRequestLine(char* text)
 {
-    url = strpbrk(text, " \t"); 
+    // 行尾的"\r\n"已被parseLine替换成'\0'，checkedIdx就是这一行的末尾
+    char* end = readBuf + checkedIdx;
+    url = (char*)httpScanner::findSpace(text, end);
     // ' '和'\t'
     // 在text中找到第一个匹配" \t"中任一字符的位置，返回该位置的指针
 
     // 如果请求行中没有空白字符或'\t'字符，则HTTP请求必有问题
-    if (!url) return BAD_REQUEST;
+    if (url == end) return BAD_REQUEST;
     *url++ = '\0';  // 将请求方法与url分隔开，text指的是请求方法，而url指的是url
 
     char* meth = text;
@@ -238,9 +392,9 @@ httpConnection::HTTP_CODE httpConnection::parseRequestLine(char* text)
 
     url += strspn(url, " \t");
     // 跳过url前的空白字符，url = "/index.html HTTP/1.1"
-    version = strpbrk(url, " \t");
+    version = (char*)httpScanner::findSpace(url, end);
     // version 指向 "index.html HTTP/1.1"中的第一个空格
-    if (!version) return BAD_REQUEST;
+    if (version == end) return BAD_REQUEST;
     *version++ = '\0';
     // url = "/index.html", version = "HTTP/1.1"
     version += strspn(version, " \t");
@@ -282,37 +436,81 @@ httpConnection::HTTP_CODE httpConnection::parseHeaders(char* text)
         // 如果没有请求体，则说明解析完毕
         return GET_REQUEST; 
     }
-    else if (strncasecmp(text, "Connection:", 11) == 0)
+
+    // 名字和值都只记录位置，不拷贝；没有冒号的行忽略
+    char* colon = (char*)memchr(text, ':', readBuf + checkedIdx - text);
+    if (!colon) return NO_REQUEST;
+    if ((int)headers.size() >= HEADER_MAX) return BAD_REQUEST;
+
+    char* value = colon + 1;
+    value += strspn(value, " \t");
+    headerField field;
+    field.nameOff = text - readBuf - requestStart;
+    field.nameLen = colon - text;
+    field.valueOff = value - readBuf - requestStart;
+    field.valueLen = strlen(value);
+    headers.push_back(field);
+
+    // 一次哈希加一次比较确定种类，未知的请求头只保留不处理
+    int id = lookupHeader(text, field.nameLen);
+    if (id == HEADER_UNKNOWN) return NO_REQUEST;
+    headerIndex[id] = headers.size();
+
+    switch (id)
     {
-        text += 11;
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0) linger = true;
-    }
-    else if (strncasecmp(text, "Content-Length:", 15) == 0)
+    case HEADER_CONNECTION:
     {
-        text += 15;
-        text += strspn(text, " \t");
-        contentLength = atol(text);
+        if (strcasecmp(value, "keep-alive") == 0) linger = true;
+        break;
     }
-    else if (strncasecmp(text, "Host:", 5) == 0)
+    case HEADER_CONTENT_LENGTH:
     {
-        text += 5;
-        text += strspn(text, " \t");
-        host = text;
+        contentLength = atol(value);
+        if (contentLength < 0) return BAD_REQUEST;
+        break;
     }
-    else
+    case HEADER_HOST:
     {
-        LOG_INFO("oop! unknow header: %s", text);
+        host = value;
+        break;
+    }
+    default:
+        break;
     }
     return NO_REQUEST;
 }
 
+// 取已知请求头的值，没有出现时返回NULL，len返回值的长度
+const char* httpConnection::getHeader(int id, int* len)
+{
+    if (id < 0 || id >= HEADER_KNOWN || headerIndex[id] == 0) return NULL;
+    const headerField& field = headers[headerIndex[id] - 1];
+    if (len) *len = field.valueLen;
+    return readBuf + requestStart + field.valueOff;
+}
+
+// 按名字查找任意请求头，包括不在已知表里的
+const char* httpConnection::findHeader(const char* name, int* len)
+{
+    int nameLen = strlen(name);
+    for (size_t i = 0; i < headers.size(); i ++ )
+    {
+        const headerField& field = headers[i];
+        if (field.nameLen == nameLen && strncasecmp(readBuf + requestStart + field.nameOff, name, nameLen) == 0)
+        {
+            if (len) *len = field.valueLen;
+            return readBuf + requestStart + field.valueOff;
+        }
+    }
+    return NULL;
+}
+
 // 判断HTTP请求是否被完整读入
+// 请求体后面可能紧跟着下一个流水线请求，不能写'\0'，由doRequest按contentLength取
 httpConnection::HTTP_CODE httpConnection::parseContent(char* text)
 {
     if (readIdx >= (contentLength + checkedIdx))
     {
-        text[contentLength] = '\0';
         // POST请求中最后为输入的用户名和密码
         headString = text;
         return GET_REQUEST;
@@ -328,13 +526,14 @@ httpConnection::HTTP_CODE httpConnection::processRead()
     HTTP_CODE ret = NO_REQUEST;
     char* text = 0;
 
+    // 请求体不按行解析，否则parseLine会越过请求体修改checkedIdx
     while ((checkState == CHECK_STATE_CONTENT && lineStatus == LINE_OK)
-            || ((lineStatus = parseLine()) == LINE_OK))
+            || (checkState != CHECK_STATE_CONTENT && (lineStatus = parseLine()) == LINE_OK))
     // 循环读取数据，直到无数据可读或对方关闭连接
     {
         text = getLine();
         startLine = checkedIdx;
-        LOG_INFO("%s", text);
+        if (checkState != CHECK_STATE_CONTENT) LOG_INFO("%s", text);
         switch (checkState)
         {
         case CHECK_STATE_REQUESTLINE:
@@ -346,6 +545,7 @@ httpConnection::HTTP_CODE httpConnection::processRead()
         case CHECK_STATE_HEADER:
         {
             ret = parseHeaders(text);
+            if (ret == BAD_REQUEST) return BAD_REQUEST;
             if (ret == GET_REQUEST) return doRequest();
             break;
         }
@@ -364,6 +564,28 @@ httpConnection::HTTP_CODE httpConnection::processRead()
     return NO_REQUEST;
 }
 
+// 异步写入线程中的回调：先更新用户存储，连接在等待期间被关闭或重新初始化时丢弃结果，否则交给线程池继续
+void httpConnection::dbDone(sqlTask* task)
+{
+    httpConnection* conn = (httpConnection*)task->arg;
+    // 先更新存储的缓存再放开用户名，中间不会有查重漏掉它的时刻
+    if (!task->result) store->Added(conn->dbUser, conn->dbPasswd);
+    lock.lock();
+    registering.erase(conn->dbUser);
+    lock.unlock();
+
+    // 和关闭路径抢同一个票号：连接已经关闭或重新初始化时票号已经变了，结果直接丢弃
+    unsigned ticket = task->ticket;
+    bool current = conn->dbTicket.compare_exchange_strong(ticket, ticket + 1);
+    if (current)
+    {
+        conn->dbState = DB_DONE;
+        conn->state = 2;
+    }
+    conn->dbBusy = false;
+    if (current) resume(conn);
+}
+
 // 比如url = /2user=alice&password=12345
 httpConnection::HTTP_CODE httpConnection::doRequest()
 {
@@ -389,44 +611,87 @@ httpConnection::HTTP_CODE httpConnection::doRequest()
         // user=alice&password=12345
         char name[100], passwd[100];
         int i;
-        for (i = 5; headString[i] != '&'; i ++ ) name[i - 5] = headString[i];
+        for (i = 5; i < contentLength && i < 104 && headString[i] != '&'; i ++ ) name[i - 5] = headString[i];
         name[i - 5] = '\0';
 
         int j = 0;
-        for (i = i + 10; headString[i] != '\0'; i ++ , j ++ ) passwd[j] = headString[i];
+        for (i = i + 10; i < contentLength && j < 99; i ++ , j ++ ) passwd[j] = headString[i];
         passwd[j] = '\0';
 
         if (*(p + 1) == '3')
         {
-            // 如果是注册，首先检测数据库中是否有重名的
-            // 如果没有，则插入数据库中
-            char* sqlInsert = (char*)malloc(sizeof(char) * 200);
-            strcpy(sqlInsert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sqlInsert, "'");
-            strcat(sqlInsert, name);
-            strcat(sqlInsert, "', '");
-            strcat(sqlInsert, passwd);
-            strcat(sqlInsert, "')");
-
-            if (users.find(name) == users.end())
-            {
-                lock.lock();
-                int res = mysql_query(mysql, sqlInsert);
-                users.insert(pair<string, string>(name, passwd));
-                lock.unlock();
+            // 如果是注册，首先检测用户存储中是否有重名的
+            // 如果没有，则写入用户存储
 
+            // 异步写入已经有结果，第二次进入doRequest
+            if (dbState == DB_DONE)
+            {
+                dbState = DB_IDLE;
+                int res = dbTask.result;
+                // 存储不可用，不能当作用户名重复
+                if (res == -1) return SERVICE_UNAVAILABLE;
                 if (!res) strcpy(url, "/log.html");
                 // 注册成功，返回登录界面
                 else strcpy(url, "/registerError.html");
             }
-            else strcpy(url, "/registerError.html");
+            else
+            {
+                // 先在锁内占住用户名，再在锁外检查是否已存在，检查可能要查一次数据库
+                lock.lock();
+                bool taken = registering.count(name);
+                if (!taken) registering.insert(name);
+                lock.unlock();
+
+                if (!taken)
+                {
+                    int exists = store->Exists(name);
+                    if (exists)
+                    {
+                        lock.lock();
+                        registering.erase(name);
+                        lock.unlock();
+                        if (exists < 0) return SERVICE_UNAVAILABLE;
+                        taken = true;
+                    }
+                }
+
+                if (taken) strcpy(url, "/registerError.html");
+                else
+                {
+                    // 存储支持异步写入时本线程不等结果直接返回，结果回来后由resume重新投递
+                    if (resume && !dbBusy)
+                    {
+                        dbTask.ticket = dbTicket;
+                        strcpy(dbUser, name);
+                        strcpy(dbPasswd, passwd);
+                        dbState = DB_WAITING;
+                        dbBusy = true;
+                        if (store->Submit(&dbTask, name, passwd)) return DB_PENDING;
+                        dbBusy = false;
+                        dbState = DB_IDLE;
+                    }
+
+                    // 不支持异步写入或队列已满时在本线程同步写入
+                    int res = store->Add(name, passwd);
+                    lock.lock();
+                    registering.erase(name);
+                    lock.unlock();
+
+                    if (res == -1) return SERVICE_UNAVAILABLE;
+                    if (!res) strcpy(url, "/log.html");
+                    else strcpy(url, "/registerError.html");
+                }
+            }
         }
 
         // 如果是登录，直接判断
         // 如果输入的用户名和密码在表中可以查找到，返回1，否则返回0
         else if (*(p + 1) == '2')
         {
-            if (users.find(name) != users.end() && users[name] == passwd) strcpy(url, "/welcome.html");
+            // 不加锁直接查，和注册并发也是安全的
+            int match = store->Check(name, passwd);
+            if (match < 0) return SERVICE_UNAVAILABLE;
+            if (match) strcpy(url, "/welcome.html");
             else strcpy(url, "/logError.html");
         }
     }
@@ -469,16 +734,57 @@ httpConnection::HTTP_CODE httpConnection::doRequest()
     }
     else strncpy(realFile + len, url, FILENAME_LEN - len - 1);
 
+    // 小文件命中响应缓存时，状态行、头部和内容都已经拼好，不再做任何文件操作
+    // 未命中时沿用响应缓存已经做过的stat，不存在的文件直接返回
+    int statRet = 0;
+    if (useResponseCache)
+    {
+        cachedResponse = responseCache::GetInstance()->GetResponse(realFile, fileState, statRet);
+        if (cachedResponse)
+        {
+            fileState = cachedResponse->st;
+            return FILE_REQUEST;
+        }
+        if (statRet < 0) return NO_RESOURCE;
+    }
+
     // 通过stat获取请求资源文件信息，成功则将信息更新到fileState结构体
+    // 开启文件缓存时stat/open/mmap都由fileCache完成，命中时不再有系统调用
     // (1) 失败返回NO_RESOURCE状态，表示请求的资源文件不存在
     // (2) 如果没有访问权限，则返回FORBIDDEN_REQUEST状态
     // (3) 如果是目录，则返回BAD_REQUEST状态，表示请求报文有误
     // (4) 成功则返回FILE_REQUEST状态，表示获取文件成功
-    if (stat(realFile, &fileState) < 0) return NO_RESOURCE;
+    if (useFileCache)
+    {
+        cachedFile = fileCache::GetInstance()->GetFile(realFile, statRet == 1 ? &fileState : NULL);
+        if (!cachedFile) return NO_RESOURCE;
+        fileState = cachedFile->st;
+    }
+    else if (statRet == 0 && stat(realFile, &fileState) < 0) return NO_RESOURCE;
     if (!fileState.st_mode & S_IROTH) return FORBIDDEN_REQUEST;
     if (S_ISDIR(fileState.st_mode)) return BAD_REQUEST;
 
+    // 缓存的描述符和共享映射直接拿来用，太大没有映射的文件仍按次mmap
+    if (cachedFile)
+    {
+        if (fileSendMode == 1) fileFd = cachedFile->fd;
+        else if (cachedFile->addr) fileAddress = cachedFile->addr;
+        else if (fileState.st_size > 0)
+        {
+            fileAddress = (char*)mmap(0, fileState.st_size, PROT_READ, MAP_PRIVATE, cachedFile->fd, 0);
+        }
+        return FILE_REQUEST;
+    }
+
     int fd = open(realFile, O_RDONLY);
+    if (fd < 0) return NO_RESOURCE;
+
+    // sendfile模式保留文件描述符，由内核直接从页缓存发送，省掉mmap/munmap
+    if (fileSendMode == 1)
+    {
+        fileFd = fd;
+        return FILE_REQUEST;
+    }
     fileAddress = (char*)mmap(0, fileState.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
     return FILE_REQUEST;
@@ -487,89 +793,239 @@ httpConnection::HTTP_CODE httpConnection::doRequest()
 
 void httpConnection::unmap()
 {
+    if (cachedResponse)
+    {
+        responseCache::GetInstance()->ReleaseResponse(cachedResponse);
+        cachedResponse = NULL;
+        fileAddress = 0;
+        return;
+    }
+
+    // 缓存中的映射和描述符归fileCache管理，这里只归还引用
+    if (cachedFile)
+    {
+        if (fileAddress && fileAddress != cachedFile->addr) munmap(fileAddress, fileState.st_size);
+        fileCache::GetInstance()->ReleaseFile(cachedFile);
+        cachedFile = NULL;
+        fileAddress = 0;
+        fileFd = -1;
+        return;
+    }
     if (fileAddress)
     {
         munmap(fileAddress, fileState.st_size);
         fileAddress = 0;
     }
+    if (fileFd != -1)
+    {
+        close(fileFd);
+        fileFd = -1;
+    }
+}
+
+// 把doRequest取得的文件资源转交给一个排队的响应，成员清空后就可以解析下一个请求
+void httpConnection::queueResponse(int headBegin, char* body, int bodyFd, long bodyLen)
+{
+    httpResponse resp;
+    resp.headBegin = headBegin;
+    resp.headEnd = writeIdx;
+    resp.body = body;
+    resp.bodyFd = bodyFd;
+    resp.bodyLen = bodyLen;
+    resp.mapAddr = NULL;
+    resp.mapLen = fileState.st_size;
+    resp.ownFd = -1;
+    resp.cachedFile = cachedFile;
+    resp.cachedResponse = cachedResponse;
+    resp.linger = linger;
+
+    // 缓存里的映射和描述符归缓存管理，只有本次请求自己建立的才需要释放
+    if (!cachedResponse)
+    {
+        if (fileAddress && !(cachedFile && fileAddress == cachedFile->addr)) resp.mapAddr = fileAddress;
+        if (!cachedFile) resp.ownFd = fileFd;
+    }
+    responses.push_back(resp);
+    bytesToSend += (resp.headEnd - resp.headBegin) + bodyLen;
+
+    fileAddress = 0;
+    fileFd = -1;
+    cachedFile = NULL;
+    cachedResponse = NULL;
 }
 
+// 整批响应发送完或连接关闭时释放每个响应持有的资源
+void httpConnection::releaseResponses()
+{
+    for (size_t i = 0; i < responses.size(); i ++ )
+    {
+        httpResponse& resp = responses[i];
+        if (resp.cachedResponse) responseCache::GetInstance()->ReleaseResponse(resp.cachedResponse);
+        if (resp.cachedFile) fileCache::GetInstance()->ReleaseFile(resp.cachedFile);
+        if (resp.mapAddr) munmap(resp.mapAddr, resp.mapLen);
+        if (resp.ownFd != -1) close(resp.ownFd);
+    }
+    responses.clear();
+    sendIdx = 0;
+    sendOff = 0;
+    bytesToSend = 0;
+    writeIdx = 0;
+    ivCount = 0;
+    ivMore = false;
+}
+
+// 从当前发送位置起，把排队响应的内存段依次填进iv，一次writev发出整批
+// 遇到用sendfile发送的响应体时停下，ivMore表示iv之后紧跟着文件内容
+void httpConnection::buildIov()
+{
+    ivCount = 0;
+    ivMore = false;
+    long off = sendOff;
+    for (size_t i = sendIdx; i < responses.size() && ivCount < IOV_BATCH; i ++ , off = 0)
+    {
+        httpResponse& resp = responses[i];
+        long headLen = resp.headEnd - resp.headBegin;
+        if (off < headLen)
+        {
+            iv[ivCount].iov_base = writeBuf + resp.headBegin + off;
+            iv[ivCount].iov_len = headLen - off;
+            ivCount ++ ;
+            off = headLen;
+        }
+        if (resp.bodyLen == 0) continue;
+        if (resp.bodyFd != -1)
+        {
+            ivMore = ivCount > 0;
+            break;
+        }
+        if (ivCount == IOV_BATCH) break;
+        iv[ivCount].iov_base = resp.body + (off - headLen);
+        iv[ivCount].iov_len = resp.bodyLen - (off - headLen);
+        ivCount ++ ;
+    }
+}
+
+// 已发送bytes个字节，推进发送位置并重建iv，返回剩余待发送的字节数
+long httpConnection::consumeIov(long bytes)
+{
+    bytesToSend -= bytes;
+    while (bytes > 0 && sendIdx < (int)responses.size())
+    {
+        httpResponse& resp = responses[sendIdx];
+        long left = (resp.headEnd - resp.headBegin) + resp.bodyLen - sendOff;
+        if (bytes < left)
+        {
+            sendOff += bytes;
+            break;
+        }
+        bytes -= left;
+        sendIdx ++ ;
+        sendOff = 0;
+    }
+    buildIov();
+    return bytesToSend;
+}
+
+// 整批响应发送完毕，根据最后一个响应的linger决定是否保持连接
+// 缓冲区里还有后续请求的数据时保留readBuf，由调用者再交给线程池处理
+bool httpConnection::finishWrite()
+{
+    bool keep = !responses.empty() && responses.back().linger;
+    releaseResponses();
+    if (!keep)
+    {
+        releaseBuffers();
+        return false;
+    }
+
+    compactRead();
+    if (readIdx == 0)
+    {
+        init();
+        return true;
+    }
+    bufferPool::GetInstance()->Release(writeBuf, writeBufSize);
+    writeBuf = NULL;
+    writeBufSize = 0;
+    return true;
+}
+
+// 内存中的数据用writev批量发出，后面紧跟sendfile时改用带MSG_MORE的sendmsg，
+// 让头部和文件开头合并成满的报文段；文件内容按已发送字节数算出偏移，部分发送后从断点继续
 bool httpConnection::write()
 {
     int temp = 0;
     if (bytesToSend == 0)
     // 初始时没有数据需要发送
+    // 先重置连接再注册EPOLLIN，否则新请求可能在另一个线程里读进还没归还的缓冲区
     {
-        modFd(epollFd, sockfd, EPOLLIN, TRIGMode);
         init();
+        modFd(epollFd, sockfd, EPOLLIN, TRIGMode);
         return true;
     }
 
-    while (1)
+    while (bytesToSend > 0)
     {
-        temp = writev(sockfd, iv, ivCount);
-        if (temp < 0)
+        if (ivCount == 0)
         {
-            if (errno == EAGAIN)
+            httpResponse& resp = responses[sendIdx];
+            off_t offset = sendOff - (resp.headEnd - resp.headBegin);
+            temp = sendfile(sockfd, resp.bodyFd, &offset, resp.bodyLen - offset);
+            // 文件在fstat之后被截短，sendfile读到文件尾返回0，再发下去只会原地空转
+            if (temp == 0)
             {
-                modFd(epollFd, sockfd, EPOLLOUT, TRIGMode);
-                return true;
+                releaseBuffers();
+                return false;
             }
         }
-
-        // 更新已发送字节数和剩余字节数
-        bytesHaveSend += temp;
-        bytesToSend -= temp;
-
-        // 如果发送的字节大于等于iov[0].iov_len，则说明iov[0]中的数据已发送完
-        if (bytesHaveSend >= iv[0].iov_len)
-        {
-            iv[0].iov_len = 0;
-            // 发送完之后，将iov[1]中的数据发送出去
-            iv[1].iov_base = fileAddress + (bytesHaveSend - writeIdx);
-            iv[1].iov_len = bytesToSend;
-        }
-        else
+        else if (ivMore)
         {
-            iv[0].iov_base = writeBuf + bytesHaveSend;
-            iv[0].iov_len = iv[0].iov_len - bytesHaveSend;
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iv;
+            msg.msg_iovlen = ivCount;
+            temp = sendmsg(sockfd, &msg, MSG_MORE);
         }
+        else temp = writev(sockfd, iv, ivCount);
 
-        // 数据已全部发送完，根据linger决定是否关闭连接
-        if (bytesToSend <= 0)
+        if (temp < 0)
         {
-            unmap();
-            modFd(epollFd, sockfd, EPOLLIN, TRIGMode);
-
-            if (linger)
+            if (errno == EAGAIN)
             {
-                init();
+                modFd(epollFd, sockfd, EPOLLOUT, TRIGMode);
                 return true;
             }
-            else
-            {
-                return false;
-            }
+            releaseBuffers();
+            return false;
         }
+        consumeIov(temp);
     }
+
+    // 数据已全部发送完，根据linger决定是否关闭连接
+    bool keep = finishWrite();
+    if (keep && !pipelined()) modFd(epollFd, sockfd, EPOLLIN, TRIGMode);
+    return keep;
 }
 
-// 
+// 写缓冲区放不下时换更大的一档重新格式化
 bool httpConnection::addResponse(const char* format, ...)
 {
-    if (writeIdx >= WRITE_BUFFER_SIZE) return false;
+    if (!reserveWrite(WRITE_BUFFER_SIZE)) return false;
 
     // 初始化可变参数列表
     va_list argList;
     va_start(argList, format);
-    int len = vsnprintf(writeBuf + writeIdx, WRITE_BUFFER_SIZE - 1 - writeIdx, format, argList);
-    if (len >= (WRITE_BUFFER_SIZE - 1 - writeIdx))
+    int len = vsnprintf(writeBuf + writeIdx, writeBufSize - writeIdx, format, argList);
+    va_end(argList);
+    if (len < 0) return false;
+    if (len >= writeBufSize - writeIdx)
     {
+        if (!reserveWrite(writeIdx + len + 1)) return false;
+        va_start(argList, format);
+        vsnprintf(writeBuf + writeIdx, writeBufSize - writeIdx, format, argList);
         va_end(argList);
-        return false;
     }
     writeIdx += len;
-    va_end(argList);
 
     LOG_INFO("request:%s", writeBuf);
 
@@ -611,9 +1067,10 @@ bool httpConnection::addContent(const char* content)
     return addResponse("%s", content);
 }
 
-// 根据不同的HTTP请求，服务器子线程调用不同的处理函数，返回不同的response
+// 根据不同的HTTP请求，服务器子线程调用不同的处理函数，生成的response排到发送队列末尾
 bool httpConnection::processWrite(HTTP_CODE ret)
 {
+    int headBegin = writeIdx;
     switch (ret)
     {
     case INTERNAL_ERROR:
@@ -623,6 +1080,13 @@ bool httpConnection::processWrite(HTTP_CODE ret)
         if (!addContent(error500Form)) return false;
         break;
     }
+    case SERVICE_UNAVAILABLE:
+    {
+        addStatusLine(503, error503Title);
+        addHeaders(strlen(error503Form));
+        if (!addContent(error503Form)) return false;
+        break;
+    }
     case BAD_REQUEST:
     {
         addStatusLine(400, error400Title);
@@ -639,16 +1103,18 @@ bool httpConnection::processWrite(HTTP_CODE ret)
     }
     case FILE_REQUEST:
     {
+        // 命中响应缓存时整个响应作为响应体从共享缓冲区发出，writeBuf中没有头部
+        if (cachedResponse)
+        {
+            queueResponse(headBegin, cachedResponse->data[linger], -1, cachedResponse->len[linger]);
+            return true;
+        }
+
         addStatusLine(200, ok200Title);
         if (fileState.st_size != 0)
         {
-            addHeaders(fileState.st_size);
-            iv[0].iov_base = writeBuf;
-            iv[0].iov_len = writeIdx;
-            iv[1].iov_base = fileAddress;
-            iv[1].iov_len = fileState.st_size;
-            ivCount = 2;
-            bytesToSend = writeIdx + fileState.st_size;
+            if (!addHeaders(fileState.st_size)) return false;
+            queueResponse(headBegin, fileAddress, fileFd, fileState.st_size);
             return true;
         }
         else
@@ -657,29 +1123,66 @@ bool httpConnection::processWrite(HTTP_CODE ret)
             addHeaders(strlen(okString));
             if (!addContent(okString)) return false;
         }
+        break;
     }
     default:
         return false;
     }
 
-    iv[0].iov_base = writeBuf;
-    iv[0].iov_len = writeIdx;
-    ivCount = 1;
-    bytesToSend = writeIdx;
+    queueResponse(headBegin, NULL, -1, 0);
     return true;
 }
 
+// 连接只能由所属的反应堆线程关闭，它同时要从自己的时间轮上摘掉定时器
+// io_uring后端投递回环线程；epoll后端shutdown后重新注册，由反应堆收到EPOLLRDHUP后关闭
+void httpConnection::hangUp()
+{
+    if (notify) notify(this, EPOLLHUP);
+    else
+    {
+        shutdown(sockfd, SHUT_RDWR);
+        rearm(EPOLLIN);
+    }
+}
+
+// 重新注册连接关心的事件
+// epoll后端重置EPOLLONESHOT，io_uring后端交给notify投递回环线程，由环线程提交下一次收发
+void httpConnection::rearm(int ev)
+{
+    if (notify) notify(this, ev);
+    else modFd(epollFd, sockfd, ev, TRIGMode);
+}
+
 // 服务器子线程调用process函数处理HTTP请求
+// 缓冲区中流水线上的请求依次解析，响应按顺序排队后一次发出
+// 遇到Connection:close或出错的请求后不再处理后面的数据，一批满了等发送完再继续
 void httpConnection::process()
 {
-    HTTP_CODE readRet = processRead();
-    if (readRet == NO_REQUEST)
+    while (true)
     {
-        modFd(epollFd, sockfd, EPOLLIN, TRIGMode);
-        return;
+        // 数据库结果回来后从doRequest继续，请求已经解析完
+        HTTP_CODE readRet = dbState == DB_DONE ? doRequest() : processRead();
+        if (readRet == NO_REQUEST) break;
+        // 等数据库结果期间不重新注册事件，前面已排队的响应在恢复后一起发送
+        if (readRet == DB_PENDING) return;
+
+        bool writeRet = processWrite(readRet);
+        if (!writeRet)
+        {
+            hangUp();
+            return;
+        }
+        if (readRet != FILE_REQUEST) responses.back().linger = linger = false;
+        if (!linger) break;
+        nextRequest();
+        if ((int)responses.size() >= PIPELINE_MAX) break;
     }
 
-    bool writeRet = processWrite(readRet);
-    if (!writeRet) closeConnection();
-    modFd(epollFd, sockfd, EPOLLOUT, TRIGMode);
-}
\ No newline at end of file
+    if (responses.empty())
+    {
+        rearm(EPOLLIN);
+        return;
+    }
+    buildIov();
+    rearm(EPOLLOUT);
+}
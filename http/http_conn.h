@@ -18,24 +18,68 @@
 #include <sys/mman.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <map>
+#include <set>
+#include <vector>
+#include <atomic>
 
 #include "../log/log.h"
 #include "../lock/locker.h"
-#include "../CGImysql/sql_connection.h"
+#include "../CGImysql/sql_executor.h"
 #include "../timer/timer.h"
+#include "../cache/file_cache.h"
+#include "../cache/response_cache.h"
+#include "../store/user_store.h"
+#include "../buffer/buffer_pool.h"
+#include "http_scanner.h"
+#include "http_header.h"
 
 static const int FILENAME_LEN = 200;
-static const int READ_BUFFER_SIZE = 2048;
-static const int WRITE_BUFFER_SIZE = 1024;
+static const int READ_BUFFER_SIZE = 2048;           // 读缓冲区的初始大小，不够时从bufferPool换更大的一档
+static const int WRITE_BUFFER_SIZE = 1024;          // 写缓冲区的初始大小
+static const int READ_EXTRA_SIZE = 16 * 1024;       // readv附带的栈上缓冲区，一次读出超出当前容量的数据
+static const int PIPELINE_MAX = 16;                 // 一批最多处理的流水线请求数
+static const int IOV_BATCH = 16;                    // 一次writev最多带的内存段数
+static const int HEADER_MAX = 100;                  // 一个请求最多的请求头数
+
+// 一个请求头的名字和值，偏移相对于请求在readBuf中的起始位置，缓冲区扩容或整理后仍然有效
+struct headerField
+{
+    int             nameOff;
+    int             nameLen;
+    int             valueOff;
+    int             valueLen;
+};
+
+// 排队等待发送的一个响应：头部在writeBuf中，响应体在内存中或由sendfile发送
+// 响应持有的映射、文件和缓存引用在整批发送完之后统一释放
+struct httpResponse
+{
+    int             headBegin;                          // 头部在writeBuf中的起止偏移
+    int             headEnd;
+    char*           body;
+    int             bodyFd;                             // 不为-1时响应体用sendfile发送
+    long            bodyLen;
+    char*           mapAddr;                            // 本次请求私有的映射，释放时munmap
+    long            mapLen;
+    int             ownFd;                              // 本次请求自己打开的文件，释放时close
+    fileEntry*      cachedFile;
+    responseEntry*  cachedResponse;
+    bool            linger;
+};
 
 class httpConnection
 {
     public:
-        static int      epollFd;
-        static int      userCount;
-        MYSQL*          mysql;
-        int             state;
+        static std::atomic<int> userCount;
+        static void     (*notify)(httpConnection* conn, int ev);   // io_uring后端：把事件投递回环线程
+        static int      fileSendMode;                               // 文件发送方式，0为mmap + writev，1为sendfile
+        static int      useFileCache;                               // 是否通过fileCache复用打开的文件
+        static int      useResponseCache;                           // 小文件是否直接发送预先拼好的完整响应
+        static userStore* store;                                    // 登录和注册使用的用户存储
+        static void     (*resume)(httpConnection* conn);            // 数据库结果回来后把连接重新交给线程池
+        int             state;                                      // reactor模式下：0读，1写，2已读入待处理
         enum METHOD
         {
             GET,
@@ -63,7 +107,15 @@ class httpConnection
             FORBIDDEN_REQUEST,
             FILE_REQUEST,
             INTERNAL_ERROR,
-            CLOSED_CONNECTION
+            CLOSED_CONNECTION,
+            SERVICE_UNAVAILABLE,                                    // 数据库连接池耗尽或数据库不可用
+            DB_PENDING                                              // 已提交数据库语句，等结果回来再继续
+        };
+        enum DB_STATE
+        {
+            DB_IDLE,
+            DB_WAITING,
+            DB_DONE
         };
         enum LINE_STATUS
         {
@@ -72,27 +124,45 @@ class httpConnection
             LINE_OPEN
         };
 
-        httpConnection() {}
+        httpConnection() : readBuf(NULL), readBufSize(0), writeBuf(NULL), writeBufSize(0), 
+                           fileAddress(0), fileFd(-1), cachedFile(NULL), cachedResponse(NULL), dbState(DB_IDLE), dbTicket(0), dbBusy(false)
+        {
+            dbTask.done = dbDone;
+            dbTask.arg = this;
+        }
         ~httpConnection() {}
-        void                init(int _sockfd, const sockaddr_in& _addr, char* _root, int _TRIGMode, 
+        void                init(int _epollFd, int _sockfd, const sockaddr_in& _addr, char* _root, int _TRIGMode, 
                                  int _closeLog, string _user, string _passwd, string _sqlName);
         void                closeConnection(bool realClose = true);
         void                process();
         bool                readOnce();
         bool                write();
         sockaddr_in*        getAddress() { return &address; }
-        void                initMysqlResult(connectionPool* connPool);
-        int                 timerFlag;
-        int                 improv;
+        bool                recvData(const char* data, int len);
+        long                consumeIov(long bytes);
+        bool                finishWrite();
+        struct iovec*       getIov() { return iv; }
+        int                 getIovCount() { return ivCount; }
+        void                releaseBuffers();
+        const char*         getHeader(int id, int* len = NULL);
+        const char*         findHeader(const char* name, int* len = NULL);
+        bool                pipelined() { return bytesToSend == 0 && readIdx > 0; }  // 发送完一批后缓冲区里还有后续请求的数据
+        bool                dbBound() const;
+        void                hangUp();
+        void                onClose();
 
     private:
+        int                 epollFd;                            // 连接所属反应堆的epoll实例
         int                 sockfd;
         sockaddr_in         address;
-        char                readBuf[READ_BUFFER_SIZE];
+        char*               readBuf;                            // 从bufferPool借来，连接空闲时归还
+        int                 readBufSize;
         long                readIdx;                            // 已经读取的字节数
         long                checkedIdx;                         // 已经检查过的字节数
         int                 startLine;
-        char                writeBuf[WRITE_BUFFER_SIZE];
+        long                requestStart;                       // 当前请求在readBuf中的起始位置
+        char*               writeBuf;
+        int                 writeBufSize;
         int                 writeIdx;
         CHECK_STATE         checkState;
         METHOD              method;
@@ -100,24 +170,38 @@ class httpConnection
         char*               url;
         char*               version;
         char*               host;
+        vector<headerField> headers;                            // 当前请求的全部请求头，按出现顺序
+        unsigned char       headerIndex[HEADER_KNOWN];          // 已知请求头在headers中的下标加一，0表示没有出现
         int                 contentLength;                      // HTTP请求体的长度
         bool                linger;                             // 是否持续保持连接
         char*               fileAddress;
+        int                 fileFd;                             // sendfile模式下打开的文件
+        fileEntry*          cachedFile;                         // 从fileCache取得的文件，响应结束时归还
+        responseEntry*      cachedResponse;                     // 从responseCache取得的完整响应，响应结束时归还
         struct stat         fileState;
-        struct iovec        iv[2];                              // iv用来管理缓冲区
+        struct iovec        iv[IOV_BATCH];                      // iv用来管理缓冲区
         int                 ivCount;
+        bool                ivMore;                             // iv后面紧跟sendfile发送的文件内容
+        vector<httpResponse> responses;                         // 按请求顺序排队的响应
+        int                 sendIdx;                            // 正在发送的响应
+        long                sendOff;                            // 正在发送的响应已发出的字节数
         int                 cgi;
         char*               headString;                         // 存储请求头数据
-        int                 bytesToSend;
-        int                 bytesHaveSend;
+        long                bytesToSend;
         char*               docRoot;
-        map<string, string> users;
         int                 TRIGMode;
         int                 closeLog;
         char                sqlUser[100];
         char                sqlPasswd[100];
         char                sqlName[100];
+        sqlTask             dbTask;                             // 正在异步写入的注册
+        char                dbUser[100];                        // 注册的用户名和密码，结果回来时更新users
+        char                dbPasswd[100];
+        int                 dbState;
+        std::atomic<unsigned> dbTicket;                         // 连接重新初始化时加一，丢弃旧连接的数据库结果
+        std::atomic<bool>   dbBusy;                             // dbTask还在异步写入中，不能再次提交
 
+        static void         dbDone(sqlTask* task);
         void                init();
         HTTP_CODE           processRead();
         bool                processWrite(HTTP_CODE ret);
@@ -128,6 +212,15 @@ class httpConnection
         char*               getLine() { return readBuf + startLine; };
         LINE_STATUS         parseLine();
         void                unmap();
+        bool                reserveRead(int size);
+        bool                reserveWrite(int size);
+        int                 readSome();
+        void                nextRequest();
+        void                compactRead();
+        void                queueResponse(int headBegin, char* body, int bodyFd, long bodyLen);
+        void                releaseResponses();
+        void                buildIov();
+        void                rearm(int ev);
         bool                addResponse(const char* format, ...);
         bool                addContent(const char* content);
         bool                addStatusLine(int status, const char* title);
@@ -0,0 +1,27 @@
+#include "http_header.h"
+#include <strings.h>
+
+// 槽里已知请求头名字的长度，空槽为0
+constexpr int headerLenAtSlot(int slot)
+{
+    return headerAtSlot(slot) == HEADER_UNKNOWN ? 0 : headerNameLen(HEADER_NAMES[headerAtSlot(slot)]);
+}
+
+#define HEADER_SLOT_4(f, n)     f(n), f(n + 1), f(n + 2), f(n + 3)
+#define HEADER_SLOT_16(f, n)    HEADER_SLOT_4(f, n), HEADER_SLOT_4(f, n + 4), HEADER_SLOT_4(f, n + 8), HEADER_SLOT_4(f, n + 12)
+#define HEADER_SLOT_64(f)       HEADER_SLOT_16(f, 0), HEADER_SLOT_16(f, 16), HEADER_SLOT_16(f, 32), HEADER_SLOT_16(f, 48)
+
+static_assert(HEADER_SLOTS == 64, "slot tables below are written out for 64 slots");
+
+// 槽号到已知请求头及其名字长度的映射，都在编译期算好
+static constexpr signed char headerSlots[HEADER_SLOTS] = { HEADER_SLOT_64(headerAtSlot) };
+static constexpr unsigned char headerSlotLens[HEADER_SLOTS] = { HEADER_SLOT_64(headerLenAtSlot) };
+
+int lookupHeader(const char* name, int len)
+{
+    if (len <= 0) return HEADER_UNKNOWN;
+    int slot = headerHash(name, len);
+    if (headerSlotLens[slot] != len) return HEADER_UNKNOWN;
+    if (strncasecmp(name, HEADER_NAMES[headerSlots[slot]], len) != 0) return HEADER_UNKNOWN;
+    return headerSlots[slot];
+}
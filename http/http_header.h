@@ -0,0 +1,90 @@
+#pragma once
+
+
+// 已知的请求头，顺序与HEADER_NAMES一致
+enum HEADER_ID
+{
+    HEADER_HOST,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_USER_AGENT,
+    HEADER_ACCEPT,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_ACCEPT_LANGUAGE,
+    HEADER_ACCEPT_CHARSET,
+    HEADER_COOKIE,
+    HEADER_REFERER,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_RANGE,
+    HEADER_RANGE,
+    HEADER_CACHE_CONTROL,
+    HEADER_PRAGMA,
+    HEADER_UPGRADE_INSECURE_REQUESTS,
+    HEADER_ORIGIN,
+    HEADER_AUTHORIZATION,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_EXPECT,
+    HEADER_KEEP_ALIVE,
+    HEADER_UPGRADE,
+    HEADER_X_FORWARDED_FOR,
+    HEADER_DNT,
+    HEADER_KNOWN,                   // 已知请求头的个数
+    HEADER_UNKNOWN = -1
+};
+
+static const int HEADER_SLOTS = 64;     // 哈希表大小，必须是2的幂
+
+constexpr const char* HEADER_NAMES[HEADER_KNOWN] =
+{
+    "Host", "Connection", "Content-Length", "Content-Type", "User-Agent",
+    "Accept", "Accept-Encoding", "Accept-Language", "Accept-Charset", "Cookie",
+    "Referer", "If-None-Match", "If-Modified-Since", "If-Range", "Range",
+    "Cache-Control", "Pragma", "Upgrade-Insecure-Requests", "Origin", "Authorization",
+    "Transfer-Encoding", "Expect", "Keep-Alive", "Upgrade", "X-Forwarded-For",
+    "DNT"
+};
+
+constexpr int headerLower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : (unsigned char)c;
+}
+
+constexpr int headerNameLen(const char* s)
+{
+    return *s ? 1 + headerNameLen(s + 1) : 0;
+}
+
+// 只看长度、首字母和尾字母，不区分大小写；对上面的已知请求头没有冲突
+constexpr int headerHash(const char* name, int len)
+{
+    return (len + 4 * headerLower(name[0]) + headerLower(name[len - 1])) & (HEADER_SLOTS - 1);
+}
+
+constexpr int headerSlotOf(int id)
+{
+    return headerHash(HEADER_NAMES[id], headerNameLen(HEADER_NAMES[id]));
+}
+
+// 编译期检查任意两个已知请求头都不在同一个槽里
+constexpr bool headerSlotUnique(int i, int j)
+{
+    return j >= HEADER_KNOWN ? true : (headerSlotOf(i) != headerSlotOf(j) && headerSlotUnique(i, j + 1));
+}
+
+constexpr bool headerHashPerfect(int i)
+{
+    return i >= HEADER_KNOWN ? true : (headerSlotUnique(i, i + 1) && headerHashPerfect(i + 1));
+}
+
+static_assert(headerHashPerfect(0), "header hash has collisions, adjust headerHash");
+
+// 槽里放的是哪个已知请求头，空槽为HEADER_UNKNOWN
+constexpr int headerAtSlot(int slot, int id = 0)
+{
+    return id >= HEADER_KNOWN ? HEADER_UNKNOWN : (headerSlotOf(id) == slot ? id : headerAtSlot(slot, id + 1));
+}
+
+// 一次哈希加一次比较确定请求头的种类，name不要求以'\0'结尾
+int lookupHeader(const char* name, int len);
@@ -0,0 +1,111 @@
+#include <string.h>
+#include "http_scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCANNER_X86 1
+#endif
+
+const char* (*httpScanner::findPair)(const char* p, const char* end, char a, char b) = httpScanner::select();
+
+const char* httpScanner::findPairScalar(const char* p, const char* end, char a, char b)
+{
+    for (; p < end; p ++ )
+    {
+        if (*p == a || *p == b) return p;
+    }
+    return end;
+}
+
+#if defined(SCANNER_X86) && defined(__SSE2__)
+const char* httpScanner::findPairSSE2(const char* p, const char* end, char a, char b)
+{
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; p + 16 <= end; p += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    // 不足16个字节的尾部逐个比较，避免读越过缓冲区末尾
+    return findPairScalar(p, end, a, b);
+}
+#else
+const char* httpScanner::findPairSSE2(const char* p, const char* end, char a, char b)
+{
+    return findPairScalar(p, end, a, b);
+}
+#endif
+
+#if defined(SCANNER_X86) && defined(__GNUC__)
+__attribute__((target("avx2")))
+const char* httpScanner::findPairAVX2(const char* p, const char* end, char a, char b)
+{
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; p + 32 <= end; p += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)p);
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb)));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    // 尾部在本函数内用VEX编码的16字节比较和逐字节比较处理完
+    // 不能尾调用findPairSSE2：编译器在跳转前不插vzeroupper，之后的传统SSE指令每次都要付出状态切换的代价
+    const __m128i va16 = _mm256_castsi256_si128(va);
+    const __m128i vb16 = _mm256_castsi256_si128(vb);
+    if (p + 16 <= end)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, va16), _mm_cmpeq_epi8(chunk, vb16)));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    for (; p < end; p ++ )
+    {
+        if (*p == a || *p == b) return p;
+    }
+    return end;
+}
+#else
+const char* httpScanner::findPairAVX2(const char* p, const char* end, char a, char b)
+{
+    return findPairSSE2(p, end, a, b);
+}
+#endif
+
+// 静态初始化时选一次实现，之后每次调用只是一次间接跳转
+// 请求头的行大多不到32字节，AVX2的宽循环很少跑满，bench/scanner_bench在录下的请求头上测得它比SSE2慢，
+// 所以能用SSE2时默认用SSE2，AVX2只在编译目标没有SSE2时使用
+const char* (*httpScanner::select())(const char* p, const char* end, char a, char b)
+{
+#if defined(SCANNER_X86) && defined(__SSE2__)
+    return findPairSSE2;
+#else
+#if defined(SCANNER_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return findPairAVX2;
+#endif
+    return findPairScalar;
+#endif
+}
+
+const char* httpScanner::implName()
+{
+    if (findPair == findPairAVX2) return "avx2";
+    if (findPair == findPairSSE2) return "sse2";
+    return "scalar";
+}
+
+const char* (*httpScanner::impl(const char* name))(const char* p, const char* end, char a, char b)
+{
+    if (strcmp(name, "scalar") == 0) return findPairScalar;
+#if defined(SCANNER_X86) && defined(__SSE2__)
+    if (strcmp(name, "sse2") == 0) return findPairSSE2;
+#endif
+#if defined(SCANNER_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) return findPairAVX2;
+#endif
+    return NULL;
+}
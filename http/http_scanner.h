@@ -0,0 +1,24 @@
+#pragma once
+
+
+#include <stddef.h>
+
+// 请求解析用的字节扫描：在[p, end)中找第一个等于a或b的字节，找不到返回end
+// 一次比较16(SSE2)或32(AVX2)个字节，x86上默认用SSE2（请求头的行短，AVX2反而更慢），非x86平台用逐字节的版本
+class httpScanner
+{
+    public:
+        static const char*  (*findPair)(const char* p, const char* end, char a, char b);
+
+        static const char*  findLineEnd(const char* p, const char* end) { return findPair(p, end, '\r', '\n'); }
+        static const char*  findSpace(const char* p, const char* end) { return findPair(p, end, ' ', '\t'); }
+        static const char*  implName();
+        // 按名字（"scalar"、"sse2"、"avx2"）取某一种实现，当前CPU或编译目标不支持时返回NULL，供基准测试逐个比较
+        static const char*  (*impl(const char* name))(const char* p, const char* end, char a, char b);
+
+    private:
+        static const char*  findPairScalar(const char* p, const char* end, char a, char b);
+        static const char*  findPairSSE2(const char* p, const char* end, char a, char b);
+        static const char*  findPairAVX2(const char* p, const char* end, char a, char b);
+        static const char*  (*select())(const char* p, const char* end, char a, char b);
+};
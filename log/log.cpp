@@ -1,164 +1,411 @@
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
+#include <stdint.h>
+#include <sys/uio.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
 #include "log.h"
 #include <pthread.h>
 using namespace std;
 
+static const int LOG_IOV_MAX = IOV_MAX < 256 ? IOV_MAX : 256;  // 一次writev最多写出的缓冲区数
+
+static const char *levelName[] = {"[debug]:", "[info]:", "[warn]:", "[erro]:"};
+
 Log::Log()
 {
     m_count = 0;
     m_is_async = false;
+    m_fd = -1;
+    m_max_queue = 0;
+    m_dropped = 0;
+    m_flushReq = false;
+    m_stop = false;
+    dir_name[0] = '\0';
+    log_name[0] = '\0';
 }
 
 Log::~Log()
 {
-    if (m_fp != NULL)
+    if (m_is_async)
+    {
+        // 后台线程退出前会把各线程剩下的日志写完
+        m_mutex.lock();
+        m_stop = true;
+        m_cond.signal();
+        m_mutex.unlock();
+        pthread_join(m_tid, NULL);
+    }
+    if (m_fd >= 0)
     {
-        fclose(m_fp);
+        close(m_fd);
     }
 }
-//异步需要设置阻塞队列的长度，同步不需要设置
+//异步需要设置写入队列的长度，同步不需要设置
 bool Log::init(const char *file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size)
 {
-    //如果设置了max_queue_size,则设置为异步
-    if (max_queue_size >= 1)
-    {
-        m_is_async = true;
-        m_log_queue = new block_queue<string>(max_queue_size);
-        pthread_t tid;
-        //flush_log_thread为回调函数,这里表示创建线程异步写日志
-        pthread_create(&tid, NULL, flush_log_thread, NULL);
-    }
-    
     closeLog = close_log;
+    // 一行日志必须能放进一个缓冲区
+    if (log_buf_size < 2 * LOG_LINE_HEAD) log_buf_size = 2 * LOG_LINE_HEAD;
+    if (log_buf_size > LOG_BUFFER_SIZE) log_buf_size = LOG_BUFFER_SIZE;
     m_log_buf_size = log_buf_size;
-    m_buf = new char[m_log_buf_size];
-    memset(m_buf, '\0', m_log_buf_size);
     m_split_lines = split_lines;
 
     time_t t = time(NULL);
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
 
- 
     const char *p = strrchr(file_name, '/');
-    char log_full_name[256] = {0};
-
     if (p == NULL)
     {
-        snprintf(log_full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
+        dir_name[0] = '\0';
+        snprintf(log_name, sizeof(log_name), "%s", file_name);
     }
     else
     {
-        strcpy(log_name, p + 1);
-        strncpy(dir_name, file_name, p - file_name + 1);
-        snprintf(log_full_name, 255, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
+        snprintf(log_name, sizeof(log_name), "%s", p + 1);
+        snprintf(dir_name, sizeof(dir_name), "%.*s", (int)(p - file_name + 1), file_name);
     }
 
     m_today = my_tm.tm_mday;
-    
-    m_fp = fopen(log_full_name, "a");
-    if (m_fp == NULL)
+    openFile(my_tm, 0);
+    if (m_fd < 0)
     {
         return false;
     }
 
+    //如果设置了max_queue_size,则设置为异步
+    if (max_queue_size >= 1)
+    {
+        m_is_async = true;
+        m_max_queue = max_queue_size;
+        //flush_log_thread为回调函数,这里表示创建线程异步写日志
+        if (pthread_create(&m_tid, NULL, flush_log_thread, NULL) != 0)
+        {
+            m_is_async = false;
+        }
+    }
+
     return true;
 }
 
-void Log::write_log(int level, const char *format, ...)
+void Log::openFile(const struct tm& my_tm, long long part)
+{
+    char new_log[300] = {0};
+    char tail[16] = {0};
+    snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
+    if (part == 0)
+    {
+        snprintf(new_log, sizeof(new_log), "%s%s%s", dir_name, tail, log_name);
+    }
+    else
+    {
+        snprintf(new_log, sizeof(new_log), "%s%s%s.%lld", dir_name, tail, log_name, part);
+    }
+
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+    }
+    m_fd = open(new_log, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+}
+
+logThread* Log::local()
 {
-    struct timeval now = {0, 0};
-    gettimeofday(&now, NULL);
-    time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
-    char s[16] = {0};
-    switch (level)
-    {
-    case 0:
-        strcpy(s, "[debug]:");
-        break;
-    case 1:
-        strcpy(s, "[info]:");
-        break;
-    case 2:
-        strcpy(s, "[warn]:");
-        break;
-    case 3:
-        strcpy(s, "[erro]:");
-        break;
-    default:
-        strcpy(s, "[info]:");
-        break;
-    }
-    //写入一个log，对m_count++, m_split_lines最大行数
+    static thread_local logThread* self = NULL;
+    if (self == NULL)
+    {
+        self = new logThread;
+        self->cur = NULL;
+        self->second = -1;
+        m_mutex.lock();
+        m_threads.push_back(self);
+        m_mutex.unlock();
+    }
+    return self;
+}
+
+// 持有t->mutex时调用，把写满的缓冲区挂到写入队列并换一块空的
+// 写入队列已满时保留原缓冲区并返回false，这一行日志被丢弃
+bool Log::nextBuffer(logThread* t)
+{
+    logBuffer* buf = NULL;
     m_mutex.lock();
-    m_count++;
-
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0) //everyday log
-    {
-        
-        char new_log[256] = {0};
-        fflush(m_fp);
-        fclose(m_fp);
-        char tail[16] = {0};
-       
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
-       
-        if (m_today != my_tm.tm_mday)
-        {
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
-            m_today = my_tm.tm_mday;
-            m_count = 0;
-        }
-        else
+    if (t->cur != NULL)
+    {
+        if ((int)m_full.size() >= m_max_queue)
         {
-            snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
+            m_dropped++;
+            m_mutex.unlock();
+            return false;
         }
-        m_fp = fopen(new_log, "a");
+        m_full.push_back(t->cur);
+        t->cur = NULL;
+        m_cond.signal();
+    }
+    if (!m_free.empty())
+    {
+        buf = m_free.back();
+        m_free.pop_back();
     }
- 
     m_mutex.unlock();
 
-    va_list valst;
-    va_start(valst, format);
+    if (buf == NULL)
+    {
+        buf = new logBuffer;
+    }
+    buf->len = 0;
+    buf->lines = 0;
+    t->cur = buf;
+    return true;
+}
 
-    string log_str;
-    m_mutex.lock();
+void Log::write_log(int level, const char *format, ...)
+{
+    const char *s = (level >= 0 && level <= 3) ? levelName[level] : levelName[1];
 
-    //写入的具体时间内容格式
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
+    logThread *self = local();
+    // 时间取自共享的粗粒度时钟，日期前缀每个线程每秒只拷贝一次
+    // 事件循环驱动时钟期间refresh不读系统时间，毫秒部分是反应堆最近一次醒来的时刻，同一轮事件里的日志时间相同
+    coarseClock::refresh();
+    uint64_t us = coarseClock::nowUs();
+    time_t sec = (time_t)(us / 1000000);
+    if (sec != self->second)
+    {
+        if (coarseClock::copyLogDate(self->date) != sec)
+        {
+            // 时钟还没来得及格式化这一秒，自己格式化一次
+            struct tm my_tm;
+            char date[64];
+            localtime_r(&sec, &my_tm);
+            snprintf(date, sizeof(date), "%d-%02d-%02d %02d:%02d:%02d",
                      my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
-    
-    int m = vsnprintf(m_buf + n, m_log_buf_size - n - 1, format, valst);
-    m_buf[n + m] = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
-
-    m_mutex.unlock();
+                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec);
+            memcpy(self->date, date, CLOCK_LOG_DATE_LEN);
+        }
+        self->second = sec;
+    }
 
-    if (m_is_async && !m_log_queue->full())
+    self->mutex.lock();
+    if (self->cur == NULL || LOG_BUFFER_SIZE - self->cur->len < m_log_buf_size)
     {
-        m_log_queue->push(log_str);
+        if (!nextBuffer(self))
+        {
+            self->mutex.unlock();
+            return;
+        }
     }
-    else
+
+    //写入的具体时间内容格式，直接写进本线程的缓冲区
+    char *p = self->cur->data + self->cur->len;
+    int n = CLOCK_LOG_DATE_LEN;
+    memcpy(p, self->date, n);
+    p[n++] = '.';
+    int msec = (int)(us / 1000 % 1000);
+    for (int i = 2; i >= 0; --i, msec /= 10) p[n + i] = '0' + msec % 10;
+    n += 3;
+    p[n++] = ' ';
+    int len = strlen(s);
+    memcpy(p + n, s, len);
+    n += len;
+    p[n++] = ' ';
+
+    va_list valst;
+    va_start(valst, format);
+    int m = vsnprintf(p + n, m_log_buf_size - n - 1, format, valst);
+    va_end(valst);
+    // 超长的行被截断
+    if (m < 0) m = 0;
+    if (m > m_log_buf_size - n - 2) m = m_log_buf_size - n - 2;
+    p[n + m] = '\n';
+    self->cur->len += n + m + 1;
+    self->cur->lines++;
+
+    if (!m_is_async)
     {
+        logBuffer *buf = self->cur;
         m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
+        writeBuffers(&buf, 1, 0);
         m_mutex.unlock();
+        buf->len = 0;
+        buf->lines = 0;
     }
-
-    va_end(valst);
+    self->mutex.unlock();
 }
 
 void Log::flush(void)
+{
+    if (!m_is_async)
+    {
+        // 同步模式每行都已直接写入文件
+        return;
+    }
+    m_mutex.lock();
+    m_flushReq = true;
+    m_cond.signal();
+    m_mutex.unlock();
+}
+
+// 把各线程未写满的缓冲区挂到写入队列，线程下次写日志时再取新缓冲区
+// 和nextBuffer一样先锁线程再锁m_mutex，保证同一线程的缓冲区按顺序入队
+void Log::sweep(vector<logThread*>& threads)
 {
     m_mutex.lock();
-    //强制刷新写入流缓冲区
-    fflush(m_fp);
+    threads = m_threads;
     m_mutex.unlock();
+
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        logThread *t = threads[i];
+        t->mutex.lock();
+        if (t->cur != NULL && t->cur->len > 0)
+        {
+            m_mutex.lock();
+            m_full.push_back(t->cur);
+            m_mutex.unlock();
+            t->cur = NULL;
+        }
+        t->mutex.unlock();
+    }
+}
+
+// 同步模式下持有m_mutex调用，异步模式下只由后台线程调用，文件和行数只在这里修改
+void Log::writeBuffers(logBuffer **bufs, int num, long long dropped)
+{
+    struct iovec iov[LOG_IOV_MAX];
+    int cnt = 0;
+    char note[64];
+
+    coarseClock::refresh();
+    time_t t = coarseClock::now();
+    struct tm my_tm;
+    //everyday log，时钟缓存的日期没变时不调用localtime
+    if (m_today != coarseClock::today())
+    {
+        localtime_r(&t, &my_tm);
+        if (m_today != my_tm.tm_mday)
+        {
+            m_today = my_tm.tm_mday;
+            m_count = 0;
+            openFile(my_tm, 0);
+        }
+    }
+
+    if (dropped > 0)
+    {
+        int n = snprintf(note, sizeof(note), "[warn]: log queue full, %lld lines dropped\n", dropped);
+        iov[cnt].iov_base = note;
+        iov[cnt].iov_len = n;
+        cnt++;
+    }
+
+    for (int i = 0; i < num; ++i)
+    {
+        iov[cnt].iov_base = bufs[i]->data;
+        iov[cnt].iov_len = bufs[i]->len;
+        cnt++;
+
+        // 超过最大行数时，写完跨过分界的缓冲区后换文件
+        long long before = m_count / m_split_lines;
+        m_count += bufs[i]->lines;
+        bool split = m_count / m_split_lines != before;
+        if (split || cnt == LOG_IOV_MAX || i == num - 1)
+        {
+            writeAll(iov, cnt);
+            cnt = 0;
+        }
+        if (split)
+        {
+            localtime_r(&t, &my_tm);
+            openFile(my_tm, m_count / m_split_lines);
+        }
+    }
+    if (cnt > 0)
+    {
+        writeAll(iov, cnt);
+    }
+}
+
+void Log::writeAll(struct iovec *iov, int cnt)
+{
+    while (cnt > 0 && m_fd >= 0)
+    {
+        ssize_t n = writev(m_fd, iov, cnt);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return;
+        }
+        // 处理部分写入
+        while (cnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if (cnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+void *Log::async_write_log()
+{
+    vector<logBuffer*> writing;     // 和m_full交换，后台写这一组时前端继续往m_full里挂
+    vector<logThread*> threads;
+    struct timeval last;
+    gettimeofday(&last, NULL);
+
+    bool stop = false;
+    while (!stop)
+    {
+        struct timeval now;
+        long long dropped;
+        bool timeUp;
+
+        m_mutex.lock();
+        if (m_full.empty() && !m_flushReq && !m_stop)
+        {
+            struct timespec deadline;
+            long long usec = last.tv_usec + LOG_FLUSH_MS * 1000LL;
+            deadline.tv_sec = last.tv_sec + usec / 1000000;
+            deadline.tv_nsec = (usec % 1000000) * 1000;
+            m_cond.timewait(m_mutex.get(), deadline);
+        }
+        gettimeofday(&now, NULL);
+        timeUp = (now.tv_sec - last.tv_sec) * 1000LL + (now.tv_usec - last.tv_usec) / 1000 >= LOG_FLUSH_MS;
+        timeUp = timeUp || m_flushReq || m_stop;
+        stop = m_stop;
+        m_flushReq = false;
+        m_mutex.unlock();
+
+        if (timeUp)
+        {
+            sweep(threads);
+            last = now;
+        }
+
+        m_mutex.lock();
+        writing.swap(m_full);
+        dropped = m_dropped;
+        m_dropped = 0;
+        m_mutex.unlock();
+
+        if (!writing.empty() || dropped > 0)
+        {
+            writeBuffers(writing.data(), (int)writing.size(), dropped);
+        }
+
+        m_mutex.lock();
+        m_free.insert(m_free.end(), writing.begin(), writing.end());
+        m_mutex.unlock();
+        writing.clear();
+    }
+    return NULL;
 }
@@ -4,12 +4,44 @@
 #include <stdio.h>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <stdarg.h>
 #include <pthread.h>
-#include "block_queue.h"
+#include "../lock/locker.h"
+#include "../clock/coarse_clock.h"
 
 using namespace std;
 
+static const int LOG_BUFFER_SIZE = 64 * 1024;  // 每个日志缓冲区的字节数
+static const int LOG_FLUSH_MS    = 1000;       // 后台线程至少每隔这么久把各线程未写满的缓冲区换出来写一次
+static const int LOG_LINE_HEAD   = 64;         // 一行日志时间和级别前缀预留的字节数
+
+// 一块定长日志缓冲区，分配后在线程、写入队列和空闲池之间循环使用
+struct logBuffer
+{
+    int     len;                    // 已写入的字节数
+    int     lines;                  // 已写入的行数，用于按行数分文件
+    char    data[LOG_BUFFER_SIZE];
+};
+
+// 每个写日志的线程一份，第一次写日志时登记，线程结束后也不回收
+// 线程只在自己的缓冲区上格式化，mutex只和后台线程换缓冲区时竞争
+struct logThread
+{
+    locker      mutex;
+    logBuffer*  cur;                // 正在写的缓冲区，被后台换走后为NULL
+    time_t      second;             // date对应的秒，同一秒内的日志直接复用
+    char        date[CLOCK_LOG_DATE_LEN];
+};
+
+// 双缓冲异步日志
+// 各线程把日志直接格式化进自己的缓冲区，写满后挂到写入队列并唤醒后台线程（大小触发），
+// 后台线程每LOG_FLUSH_MS也会把各线程未写满的缓冲区换出来（时间触发），
+// 然后把整个写入队列换到自己手里，在锁外用writev一次写出，写完的缓冲区放回空闲池
+// 写入队列中的缓冲区达到max_queue_size时不再等待，直接丢弃新日志并计数，后台下次写入时记录丢弃行数
+// 同步模式下每行格式化后立即write到文件，两种模式都不再逐行fflush
+// 行首时间只精确到毫秒，取自coarseClock：服务器运行时是反应堆最近一次从epoll_wait或io_uring_enter返回的时刻，
+// 同一轮事件处理中写的日志时间相同，不能用来度量一轮之内的耗时
 class Log
 {
 public:
@@ -23,47 +55,54 @@ public:
     static void *flush_log_thread(void *args)
     {
         Log::get_instance()->async_write_log();
+        return NULL;
     }
-    //可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列
+    //可选择的参数有日志文件、单行最大长度、最大行数以及写入队列中最多等待的缓冲区数，为0时同步写入
     bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0);
 
     void write_log(int level, const char *format, ...);
 
+    // 异步模式下让后台线程马上写出所有线程已有的日志，不等待写完
     void flush(void);
 
 private:
     Log();
     virtual ~Log();
-    void *async_write_log()
-    {
-        string single_log;
-        //从阻塞队列中取出一个日志string，写入文件
-        while (m_log_queue->pop(single_log))
-        {
-            m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
-            m_mutex.unlock();
-        }
-    }
+    void *async_write_log();
+
+    logThread*  local();
+    bool        nextBuffer(logThread* t);
+    void        sweep(vector<logThread*>& threads);
+    void        writeBuffers(logBuffer** bufs, int num, long long dropped);
+    void        writeAll(struct iovec* iov, int cnt);
+    void        openFile(const struct tm& my_tm, long long part);
 
 private:
     char dir_name[128]; //路径名
     char log_name[128]; //log文件名
     int m_split_lines;  //日志最大行数
-    int m_log_buf_size; //日志缓冲区大小
+    int m_log_buf_size; //单行日志最大长度
     long long m_count;  //日志行数记录
     int m_today;        //因为按天分类,记录当前时间是那一天
-    FILE *m_fp;         //打开log的文件指针
-    char *m_buf;
-    block_queue<string> *m_log_queue; //阻塞队列
-    bool m_is_async;                  //是否同步标志位
-    locker m_mutex;
+    int m_fd;           //打开log的文件描述符
+    bool m_is_async;    //是否异步标志位
+    locker m_mutex;     //保护下面的队列、空闲池、线程表和文件
     int closeLog; //关闭日志
+
+    int                 m_max_queue;    // 写入队列最多容纳的缓冲区数
+    vector<logBuffer*>  m_full;         // 写满或被换出、等待后台写入的缓冲区
+    vector<logBuffer*>  m_free;         // 空闲缓冲区
+    vector<logThread*>  m_threads;      // 登记过的写日志线程
+    long long           m_dropped;      // 写入队列满时丢弃的行数
+    bool                m_flushReq;
+    bool                m_stop;
+    cond                m_cond;         // 唤醒后台线程
+    pthread_t           m_tid;
 };
 
-#define LOG_DEBUG(format, ...) if(0 == closeLog) {Log::get_instance()->write_log(0, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_INFO(format, ...) if(0 == closeLog) {Log::get_instance()->write_log(1, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_WARN(format, ...) if(0 == closeLog) {Log::get_instance()->write_log(2, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_ERROR(format, ...) if(0 == closeLog) {Log::get_instance()->write_log(3, format, ##__VA_ARGS__); Log::get_instance()->flush();}
+#define LOG_DEBUG(format, ...) if(0 == closeLog) {Log::get_instance()->write_log(0, format, ##__VA_ARGS__);}
+#define LOG_INFO(format, ...) if(0 == closeLog) {Log::get_instance()->write_log(1, format, ##__VA_ARGS__);}
+#define LOG_WARN(format, ...) if(0 == closeLog) {Log::get_instance()->write_log(2, format, ##__VA_ARGS__);}
+#define LOG_ERROR(format, ...) if(0 == closeLog) {Log::get_instance()->write_log(3, format, ##__VA_ARGS__);}
 
 #endif
@@ -0,0 +1,906 @@
+#include "server.h"
+
+WebServer::WebServer()
+{
+    // httpConnection类对象
+    users = new httpConnection[MAX_FD];
+
+    // root文件夹路径
+    char serverPath[200];
+    getcwd(serverPath, 200);
+    char rootDir[6] = "/root";
+    root = (char*)malloc(strlen(serverPath) + strlen(rootDir) + 1);
+    strcpy(root, serverPath);
+    strcat(root, rootDir);
+
+    // 定时器
+    usersTimer = new clientData[MAX_FD];
+
+    pool = NULL;
+    reactors = NULL;
+    reactorNum = 1;
+    ioBackend = 0;
+    fileSendMode = 0;
+    fileCacheMode = 0;
+    responseCacheMode = 0;
+    uringConns = NULL;
+    stopServer = false;
+    tickMs = TICK_MS;
+    wakeupLogMs = 0;
+    dbThreadNum = DB_THREAD_NUM;
+    signalFd = -1;
+
+    // SIGTERM在所有线程中屏蔽，只通过signalfd接收，之后创建的线程池、日志线程都继承这个掩码
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+}
+
+WebServer::~WebServer()
+{
+    for (int i = 0; reactors && i < reactorNum; i ++ )
+    {
+        close(reactors[i].epollFd);
+        close(reactors[i].listenFd);
+        if (reactors[i].timerFd != -1) close(reactors[i].timerFd);
+        if (reactors[i].ring)
+        {
+            delete reactors[i].ring;
+            close(reactors[i].wakeFd);
+        }
+    }
+    if (signalFd != -1) close(signalFd);
+    delete[] reactors;
+    delete[] uringConns;
+    delete[] users;
+    delete[] usersTimer;
+    delete pool;
+    free(root);
+}
+
+void WebServer::init(int _port, string _user, string _password, string _databaseName, int _logWrite,
+                     int _optLinger, int _TRIGMode, int _sqlNum, int _threadNum, int _closeLog, int _actorModel,
+                     int _reactorNum, int _ioBackend, int _fileSendMode,
+                     int _fileCacheMode, int _responseCacheMode, int _tickMs,
+                     string _cpuList, int _dbThreadNum, int _userCacheSize, string _storePath)
+{
+    port = _port;
+    user = _user;
+    password = _password;
+    databaseName = _databaseName;
+    logWrite = _logWrite;
+    optLinger = _optLinger;
+    TRIGMode = _TRIGMode;
+    sqlNum = _sqlNum;
+    threadNum = _threadNum;
+    closeLog = _closeLog;
+    actorModel = _actorModel;
+    reactorNum = _reactorNum > 0 ? _reactorNum : 1;
+    ioBackend = _ioBackend;
+    fileSendMode = _fileSendMode;
+    fileCacheMode = _fileCacheMode;
+    responseCacheMode = _responseCacheMode;
+    tickMs = _tickMs > 0 ? _tickMs : TICK_MS;
+    cpuList = _cpuList;
+    dbThreadNum = _dbThreadNum > 0 ? _dbThreadNum : 0;
+    userCacheSize = _userCacheSize;
+    storePath = _storePath;
+}
+
+// 设置监听套接字和连接套接字的触发模式
+void WebServer::trigMode()
+{
+    // LT + LT
+    if (TRIGMode == 0)
+    {
+        LISTENTRIGMode = 0;
+        CONNTRIGMode = 0;
+    }
+    // LT + ET
+    else if (TRIGMode == 1)
+    {
+        LISTENTRIGMode = 0;
+        CONNTRIGMode = 1;
+    }
+    // ET + LT
+    else if (TRIGMode == 2)
+    {
+        LISTENTRIGMode = 1;
+        CONNTRIGMode = 0;
+    }
+    // ET + ET
+    else if (TRIGMode == 3)
+    {
+        LISTENTRIGMode = 1;
+        CONNTRIGMode = 1;
+    }
+}
+
+void WebServer::initLog()
+{
+    if (closeLog == 0)
+    {
+        // 初始化日志，logWrite为1时异步写入
+        if (logWrite == 1) Log::get_instance()->init("./ServerLog", closeLog, 2000, 800000, 16);
+        else Log::get_instance()->init("./ServerLog", closeLog, 2000, 800000, 0);
+    }
+}
+
+void WebServer::sqlPool()
+{
+    // 配置了本地存储文件时用户保存在映射文件中，不连接数据库
+    if (!storePath.empty())
+    {
+        connPool = NULL;
+        bool ok = mmapUserStore::GetInstance()->init(storePath, closeLog);
+        if (!ok) LOG_ERROR("user store %s init failure", storePath.c_str());
+        assert(ok);
+        httpConnection::store = mmapUserStore::GetInstance();
+        return;
+    }
+
+    // 初始化数据库连接池
+    connPool = connectionPool::GetInstance();
+    connPool->init("localhost", user, password, databaseName, 3306, sqlNum, closeLog);
+
+    // 初始化数据库读取表，按需查询模式下只建缓存，启动时间与表的大小无关
+    mysqlUserStore::GetInstance()->init(connPool, sqlNum, userCacheSize, closeLog);
+    httpConnection::store = mysqlUserStore::GetInstance();
+}
+
+static WebServer* resumeServer = NULL;
+
+// 定时器关闭epoll后端的连接时调用，io_uring后端在uringClose中直接调用onClose
+void WebServer::connClosed(int sockfd)
+{
+    resumeServer->users[sockfd].onClose();
+}
+
+// 异步写入线程调用：把等到结果的连接重新交给线程池，从doRequest继续
+// 队列满时直接在执行线程中处理，不能把连接丢下
+void WebServer::dbResume(httpConnection* conn)
+{
+    threadPool<httpConnection>* pool = resumeServer->pool;
+    if (pool->appendP(conn)) pool->flush();
+    else conn->process();
+}
+
+void WebServer::initThreadPool()
+{
+    // 线程池按绑核策略给工作线程分配CPU和NUMA节点，必须先于线程池初始化
+    cpuAffinity* affinity = cpuAffinity::GetInstance();
+    if (!affinity->init(cpuList, reactorNum))
+    {
+        LOG_ERROR("bad cpu list: %s", cpuList.c_str());
+    }
+    else if (affinity->on())
+    {
+        LOG_INFO("cpu affinity: %d cpus on %d nodes", affinity->cpuCount(), affinity->nodes());
+    }
+
+    // 登录、注册请求单独走数据库通道，阻塞在MySQL上时不占用处理静态文件的线程
+    pool = new ::threadPool<httpConnection>(actorModel, threadNum, 10000, dbThreadNum, DB_MAX_REQUEST);
+
+    // 数据库结果回来后由执行线程把连接交回线程池
+    resumeServer = this;
+    httpConnection::resume = dbResume;
+    Utils::onClose = connClosed;
+}
+
+// 创建一个监听套接字，多反应堆模式下打开SO_REUSEPORT，让每个反应堆都能绑定同一端口
+int WebServer::createListenFd(bool reusePort)
+{
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+
+    // 优雅关闭连接
+    if (optLinger == 0)
+    {
+        struct linger tmp = {0, 1};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+    }
+    else if (optLinger == 1)
+    {
+        struct linger tmp = {1, 1};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+    }
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    int flag = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    if (reusePort) setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag));
+
+    int ret = bind(fd, (struct sockaddr*)&address, sizeof(address));
+    assert(ret >= 0);
+    // 每个反应堆一个监听套接字，队列太短时突发连接会被丢掉SYN重传，用系统允许的上限
+    ret = listen(fd, SOMAXCONN);
+    assert(ret >= 0);
+    return fd;
+}
+
+void WebServer::eventListen()
+{
+    utils.init(TIMESLOT);
+
+    // io_uring后端：内核不支持时退回epoll；收发都在环线程完成，worker只负责解析，相当于模拟proactor
+    // 先在一个临时的小环上探测内核能力，再为每个反应堆建好环，任何一步失败都整体退回epoll
+    vector<ioUring*> rings;
+    if (ioBackend == 1)
+    {
+        ioUring probe;
+        bool ok = probe.init(8) && probe.initBufRing(0, 8, 64) && probe.probe();
+        for (int i = 0; ok && i < reactorNum; i ++ )
+        {
+            rings.push_back(new ioUring);
+            ok = rings.back()->init(URING_ENTRIES) && rings.back()->initBufRing(0, URING_BUF_COUNT, URING_BUF_SIZE);
+        }
+        if (!ok)
+        {
+            for (size_t i = 0; i < rings.size(); i ++ ) delete rings[i];
+            rings.clear();
+            LOG_ERROR("%s", "io_uring unavailable, fall back to epoll");
+            ioBackend = 0;
+        }
+        else
+        {
+            // 线程池在initThreadPool中按原来的模型建好，这里一起改成模拟proactor，worker不再自己读写套接字
+            actorModel = 0;
+            pool->setActorModel(0);
+            uringConns = new uringConn[MAX_FD]();
+            httpConnection::notify = uringNotify;
+        }
+    }
+
+    // 环线程通过sendmsg发送iv，io_uring后端只支持mmap方式
+    if (fileSendMode == 1 && ioBackend == 1) LOG_INFO("%s", "sendfile is not supported by io_uring backend, use mmap");
+    LOG_INFO("request scanner: %s", httpScanner::implName());
+    httpConnection::fileSendMode = (ioBackend == 1) ? 0 : fileSendMode;
+
+    // 静态文件缓存
+    if (fileCacheMode == 1) fileCache::GetInstance()->init(FILE_CACHE_ENTRIES, FILE_CACHE_BYTES, FILE_CACHE_MAP_LIMIT);
+    httpConnection::useFileCache = fileCacheMode;
+
+    // 小文件完整响应缓存，未命中的请求再走文件缓存或普通路径
+    if (responseCacheMode == 1) responseCache::GetInstance()->init(RESPONSE_CACHE_FILE_LIMIT, RESPONSE_CACHE_BYTES);
+    httpConnection::useResponseCache = responseCacheMode;
+
+    // 每个反应堆一个epoll实例（或io_uring环）和一个监听套接字
+    reactors = new subReactor[reactorNum];
+    for (int i = 0; i < reactorNum; i ++ )
+    {
+        subReactor* reactor = reactors + i;
+        reactor->id = i;
+        reactor->server = this;
+        reactor->listenFd = createListenFd(reactorNum > 1);
+        reactor->utils.init(TIMESLOT);
+        reactor->ring = NULL;
+        reactor->epollFd = -1;
+        reactor->timerFd = -1;
+        if (ioBackend == 1)
+        {
+            uringListen(reactor, rings[i]);
+            continue;
+        }
+        reactor->epollFd = epoll_create(5);
+        assert(reactor->epollFd != -1);
+        utils.addFd(reactor->epollFd, reactor->listenFd, false, LISTENTRIGMode);
+
+        // 定时器由注册在epoll中的timerfd驱动，每tickMs毫秒处理一次到期的连接
+        reactor->timerFd = Utils::createTickFd(tickMs);
+        assert(reactor->timerFd != -1);
+        utils.addFd(reactor->epollFd, reactor->timerFd, false, 0);
+    }
+    listenFd = reactors[0].listenFd;
+    epollFd = reactors[0].epollFd;
+
+    utils.addSig(SIGPIPE, SIG_IGN);
+
+    // SIGTERM已在构造函数中屏蔽，这里改为通过signalfd读取
+    // 单反应堆epoll模式下注册到反应堆的epoll中，其余模式由主线程阻塞读取
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    bool pollSignal = reactorNum == 1 && ioBackend == 0;
+    signalFd = signalfd(-1, &mask, SFD_CLOEXEC | (pollSignal ? SFD_NONBLOCK : 0));
+    assert(signalFd != -1);
+    if (pollSignal) utils.addFd(reactors[0].epollFd, signalFd, false, 0);
+}
+
+// 初始化新连接，并为其创建定时器，挂到所属反应堆的定时器链表上
+void WebServer::timer(subReactor* reactor, int connfd, struct sockaddr_in client_address)
+{
+    users[connfd].init(reactor->epollFd, connfd, client_address, root, CONNTRIGMode, closeLog, user, password, databaseName);
+
+    usersTimer[connfd].address = client_address;
+    usersTimer[connfd].epollFd = reactor->epollFd;
+    usersTimer[connfd].sockfd = connfd;
+    utilTimer* timer = &usersTimer[connfd].node;
+    timer->userData = &usersTimer[connfd];
+    timer->callBack = callBack;
+    timer->expireTime = coarseClock::nowMs() + 3 * TIMESLOT * 1000;
+    usersTimer[connfd].timer = timer;
+    reactor->utils.timWheel.addTimer(timer);
+}
+
+// 若有数据传输，则将定时器往后延迟3个单位
+void WebServer::adjustTimer(subReactor* reactor, utilTimer* timer)
+{
+    timer->expireTime = coarseClock::nowMs() + 3 * TIMESLOT * 1000;
+    reactor->utils.timWheel.adjustTimer(timer);
+}
+
+void WebServer::dealTimer(subReactor* reactor, utilTimer* timer, int sockfd)
+{
+    if (!timer) return;
+    reactor->utils.timWheel.deleteTimer(timer);
+    usersTimer[sockfd].timer = NULL;
+    timer->callBack(&usersTimer[sockfd]);
+
+    LOG_INFO("close fd %d", usersTimer[sockfd].sockfd);
+}
+
+bool WebServer::dealClientData(subReactor* reactor)
+{
+    struct sockaddr_in clientAddress;
+    socklen_t clientAddrLength = sizeof(clientAddress);
+    if (LISTENTRIGMode == 0)
+    {
+        int connfd = accept(reactor->listenFd, (struct sockaddr*)&clientAddress, &clientAddrLength);
+        if (connfd < 0)
+        {
+            LOG_ERROR("%s:errno is:%d", "accept error", errno);
+            return false;
+        }
+        // users等数组按fd下标，反应堆自己的timerfd、epoll等也占fd号，fd本身超出范围时同样拒绝
+        if (connfd >= MAX_FD || httpConnection::userCount >= MAX_FD)
+        {
+            utils.showError(connfd, "Internal server busy");
+            LOG_ERROR("%s", "Internal server busy");
+            return false;
+        }
+        timer(reactor, connfd, clientAddress);
+    }
+    else
+    {
+        while (1)
+        {
+            int connfd = accept(reactor->listenFd, (struct sockaddr*)&clientAddress, &clientAddrLength);
+            if (connfd < 0)
+            {
+                LOG_ERROR("%s:errno is:%d", "accept error", errno);
+                break;
+            }
+            if (connfd >= MAX_FD || httpConnection::userCount >= MAX_FD)
+            {
+                utils.showError(connfd, "Internal server busy");
+                LOG_ERROR("%s", "Internal server busy");
+                break;
+            }
+            timer(reactor, connfd, clientAddress);
+        }
+        return false;
+    }
+    return true;
+}
+
+// 从signalfd读出待处理的信号，单反应堆模式下非阻塞，其余模式下主线程阻塞在这里
+bool WebServer::dealSignal(bool& stop)
+{
+    struct signalfd_siginfo info[8];
+    int ret = read(signalFd, info, sizeof(info));
+    if (ret <= 0) return false;
+
+    for (int i = 0; i < ret / (int)sizeof(info[0]); i ++ )
+    {
+        if (info[i].ssi_signo == SIGTERM) stop = true;
+    }
+    return true;
+}
+
+void WebServer::dealRead(subReactor* reactor, int sockfd)
+{
+    utilTimer* timer = usersTimer[sockfd].timer;
+
+    // reactor
+    // 反应堆不等worker的结果，读写失败时worker调用hangUp，反应堆收到EPOLLRDHUP后关闭连接
+    if (actorModel == 1)
+    {
+        if (timer) adjustTimer(reactor, timer);
+
+        // 若监测到读事件，将该事件放入请求队列
+        pool->append(users + sockfd, 0);
+    }
+    // proactor
+    else
+    {
+        if (users[sockfd].readOnce())
+        {
+            // 若监测到读事件，将该事件放入请求队列
+            pool->appendP(users + sockfd);
+            if (timer) adjustTimer(reactor, timer);
+        }
+        else dealTimer(reactor, timer, sockfd);
+    }
+}
+
+void WebServer::dealWrite(subReactor* reactor, int sockfd)
+{
+    utilTimer* timer = usersTimer[sockfd].timer;
+
+    // reactor
+    if (actorModel == 1)
+    {
+        if (timer) adjustTimer(reactor, timer);
+
+        pool->append(users + sockfd, 1);
+    }
+    // proactor
+    else
+    {
+        if (users[sockfd].write())
+        {
+            // 缓冲区里还有流水线上的请求，不等EPOLLIN直接交给线程池
+            if (users[sockfd].pipelined()) pool->appendP(users + sockfd);
+            if (timer) adjustTimer(reactor, timer);
+        }
+        else dealTimer(reactor, timer, sockfd);
+    }
+}
+
+// 处理一批就绪事件，单反应堆和多反应堆共用
+void WebServer::dealEvents(subReactor* reactor, int number)
+{
+    for (int i = 0; i < number; i ++ )
+    {
+        int sockfd = reactor->events[i].data.fd;
+
+        // 处理新到的客户连接
+        if (sockfd == reactor->listenFd)
+        {
+            if (!dealClientData(reactor)) continue;
+        }
+        // 服务器端关闭连接，移除对应的定时器
+        else if (reactor->events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        {
+            utilTimer* timer = usersTimer[sockfd].timer;
+            dealTimer(reactor, timer, sockfd);
+        }
+        // 定时器到期，处理时间轮上超时的连接
+        else if (sockfd == reactor->timerFd)
+        {
+            reactor->utils.timerHandler(reactor->timerFd);
+            logWakeups(reactor);
+        }
+        // 处理信号，只有单反应堆模式会把signalfd注册进epoll
+        else if ((sockfd == signalFd) && (reactor->events[i].events & EPOLLIN))
+        {
+            bool stop = false;
+            if (!dealSignal(stop)) LOG_ERROR("%s", "dealSignal failure");
+            if (stop) stopServer = true;
+        }
+        // 处理客户连接上接收到的数据
+        else if (reactor->events[i].events & EPOLLIN) dealRead(reactor, sockfd);
+        else if (reactor->events[i].events & EPOLLOUT) dealWrite(reactor, sockfd);
+    }
+
+    // 本批事件投递的任务一起唤醒空闲的工作线程
+    pool->flush();
+}
+
+// 反应堆的事件循环，定时器由注册在epoll中的timerfd驱动，不依赖SIGALRM
+void WebServer::reactorLoop(subReactor* reactor)
+{
+    while (!stopServer)
+    {
+        int number = epoll_wait(reactor->epollFd, reactor->events, MAX_EVENT_NUMBER, -1);
+        // 每轮循环更新一次共享时钟，本轮的定时器、缓存和日志都读它
+        coarseClock::update();
+        if (number < 0 && errno != EINTR)
+        {
+            LOG_ERROR("reactor %d: %s", reactor->id, "epoll failure");
+            break;
+        }
+        if (number > 0) dealEvents(reactor, number);
+    }
+}
+
+// 0号反应堆在定时器tick时调用，每隔WAKEUP_STATS_MS输出一次投递批次数和其中真正发起唤醒系统调用的次数
+void WebServer::logWakeups(subReactor* reactor)
+{
+    if (reactor->id != 0 || coarseClock::nowMs() < wakeupLogMs) return;
+    wakeupLogMs = coarseClock::nowMs() + WAKEUP_STATS_MS;
+    LOG_INFO("thread pool wakeups: %lu futex calls for %lu batches", pool->wakeupCalls(), pool->wakeupBatches());
+}
+
+void* WebServer::reactorWorker(void* arg)
+{
+    subReactor* reactor = (subReactor*)arg;
+    cpuAffinity::GetInstance()->pinReactor(reactor->id);
+    if (reactor->ring) reactor->server->uringLoop(reactor);
+    else reactor->server->reactorLoop(reactor);
+    return reactor;
+}
+
+void WebServer::eventLoop()
+{
+    stopServer = false;
+    // 事件循环运行期间由各反应堆更新共享时钟，其他线程只读
+    coarseClock::setLoopDriven(true);
+
+    // 单反应堆：当前线程直接运行反应堆的事件循环，SIGTERM经signalfd在epoll中处理
+    if (reactorNum == 1 && ioBackend == 0)
+    {
+        cpuAffinity::GetInstance()->pinReactor(0);
+        reactorLoop(reactors);
+    }
+    // 多反应堆或io_uring后端：每个反应堆一个线程，主线程只负责等待SIGTERM
+    else
+    {
+        for (int i = 0; i < reactorNum; i ++ )
+        {
+            if (pthread_create(&reactors[i].thread, NULL, reactorWorker, reactors + i) != 0)
+            {
+                LOG_ERROR("%s", "create reactor thread failure");
+                stopServer = true;
+                reactorNum = i;
+                break;
+            }
+        }
+
+        while (!stopServer)
+        {
+            bool stop = false;
+            if (!dealSignal(stop) && errno != EINTR) break;
+            if (stop) stopServer = true;
+        }
+
+        // 各反应堆最多在一个tickMs内被定时器唤醒，发现stopServer并退出
+        for (int i = 0; i < reactorNum; i ++ ) pthread_join(reactors[i].thread, NULL);
+    }
+    coarseClock::setLoopDriven(false);
+
+    // 投递任务的批次数和其中真正发起唤醒系统调用的次数
+    LOG_INFO("thread pool wakeups: %lu futex calls for %lu batches", pool->wakeupCalls(), pool->wakeupBatches());
+}
+
+// ---------------------------------------------------------------------------
+// io_uring后端
+// 每个反应堆一个环：多发accept接收新连接，多发recv配合注册的缓冲区环收数据，sendmsg发送iv，
+// 一次io_uring_enter同时提交本轮积攒的所有SQE并等待完成事件，不再需要epoll_ctl重新注册
+// ---------------------------------------------------------------------------
+
+enum URING_OP
+{
+    URING_ACCEPT = 1,
+    URING_RECV,
+    URING_SEND,
+    URING_WAKE,
+    URING_TICK
+};
+
+// user_data：高8位是操作类型，中间24位是连接的gen，低32位是fd
+static inline uint64_t uringData(int op, unsigned gen, int fd)
+{
+    return ((uint64_t)op << 56) | ((uint64_t)(gen & 0xffffff) << 32) | (uint32_t)fd;
+}
+
+static WebServer* uringServer = NULL;
+
+// io_uring后端的定时器回调：只shutdown，挂着的recv随即返回0，由环线程完成真正的关闭
+static void uringCallBack(clientData* userData)
+{
+    shutdown(userData->sockfd, SHUT_RDWR);
+}
+
+// 环已由eventListen建好并探测过
+void WebServer::uringListen(subReactor* reactor, ioUring* ring)
+{
+    reactor->ring = ring;
+
+    reactor->wakeFd = eventfd(0, EFD_CLOEXEC);
+    assert(reactor->wakeFd != -1);
+    reactor->wakePending = false;
+    reactor->tickSpec.tv_sec = tickMs / 1000;
+    reactor->tickSpec.tv_nsec = (tickMs % 1000) * 1000000LL;
+    uringServer = this;
+}
+
+// worker线程调用：把事件投递给连接所属的环线程，同一批只写一次eventfd
+void WebServer::uringNotify(httpConnection* conn, int ev)
+{
+    WebServer* server = uringServer;
+    int fd = conn - server->users;
+    subReactor* reactor = server->uringConns[fd].reactor;
+
+    reactor->notifyLock.lock();
+    reactor->notifyQueue.push_back(std::make_pair(fd, ev));
+    reactor->notifyLock.unlock();
+
+    if (!reactor->wakePending.exchange(true))
+    {
+        uint64_t one = 1;
+        ::write(reactor->wakeFd, &one, sizeof(one));
+    }
+}
+
+void WebServer::uringAccept(subReactor* reactor, int connfd)
+{
+    if (connfd >= MAX_FD || httpConnection::userCount >= MAX_FD)
+    {
+        utils.showError(connfd, "Internal server busy");
+        LOG_ERROR("%s", "Internal server busy");
+        return;
+    }
+
+    struct sockaddr_in clientAddress;
+    socklen_t clientAddrLength = sizeof(clientAddress);
+    getpeername(connfd, (struct sockaddr*)&clientAddress, &clientAddrLength);
+    timer(reactor, connfd, clientAddress);
+    usersTimer[connfd].timer->callBack = uringCallBack;
+
+    uringConn* conn = uringConns + connfd;
+    conn->reactor = reactor;
+    conn->open = true;
+    conn->busy = false;
+    conn->closing = false;
+    conn->recvArmed = true;
+    conn->pending.clear();
+    if (!reactor->ring->prepRecvMultishot(connfd, uringData(URING_RECV, conn->gen, connfd))) uringClose(reactor, connfd);
+}
+
+void WebServer::uringRecv(subReactor* reactor, int fd, io_uring_cqe* cqe)
+{
+    uringConn* conn = uringConns + fd;
+    if (!(cqe->flags & IORING_CQE_F_MORE)) conn->recvArmed = false;
+
+    if (cqe->res > 0)
+    {
+        conn->pending.push_back(std::make_pair((int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT), cqe->res));
+        uringDrain(reactor, fd);
+    }
+    // 缓冲区用完了，等有缓冲区归还后再重新提交recv
+    else if (cqe->res == -ENOBUFS) reactor->starved.push_back(fd);
+    // 对端关闭或出错
+    else if (conn->busy) conn->closing = true;
+    else uringClose(reactor, fd);
+}
+
+// 把收到的数据交给httpConnection，并在连接空闲时投递给线程池
+void WebServer::uringDrain(subReactor* reactor, int fd)
+{
+    uringConn* conn = uringConns + fd;
+    if (!conn->open || conn->busy) return;
+    if (conn->closing)
+    {
+        uringClose(reactor, fd);
+        return;
+    }
+    if (!conn->recvArmed)
+    {
+        // 拿不到SQE时这个连接再也收不到数据，直接关闭
+        if (!reactor->ring->prepRecvMultishot(fd, uringData(URING_RECV, conn->gen, fd)))
+        {
+            uringClose(reactor, fd);
+            return;
+        }
+        conn->recvArmed = true;
+    }
+    if (conn->pending.empty()) return;
+
+    bool ok = true;
+    for (size_t i = 0; i < conn->pending.size(); i ++ )
+    {
+        int bid = conn->pending[i].first;
+        if (ok) ok = users[fd].recvData(reactor->ring->buffer(bid), conn->pending[i].second);
+        reactor->ring->recycleBuffer(bid);
+    }
+    conn->pending.clear();
+
+    if (!ok || !pool->appendP(users + fd))
+    {
+        uringClose(reactor, fd);
+        return;
+    }
+    conn->busy = true;
+
+    utilTimer* timer = usersTimer[fd].timer;
+    if (timer) adjustTimer(reactor, timer);
+}
+
+void WebServer::uringSend(subReactor* reactor, int fd)
+{
+    uringConn* conn = uringConns + fd;
+    memset(&conn->msg, 0, sizeof(conn->msg));
+    conn->msg.msg_iov = users[fd].getIov();
+    conn->msg.msg_iovlen = users[fd].getIovCount();
+    if (!reactor->ring->prepSendmsg(fd, &conn->msg, uringData(URING_SEND, conn->gen, fd)))
+    {
+        conn->busy = false;
+        uringClose(reactor, fd);
+    }
+}
+
+void WebServer::uringSent(subReactor* reactor, int fd, int res)
+{
+    uringConn* conn = uringConns + fd;
+    if (res < 0)
+    {
+        conn->busy = false;
+        uringClose(reactor, fd);
+        return;
+    }
+
+    // 部分发送，继续发剩下的
+    if (users[fd].consumeIov(res) > 0)
+    {
+        uringSend(reactor, fd);
+        return;
+    }
+
+    conn->busy = false;
+    if (!users[fd].finishWrite())
+    {
+        uringClose(reactor, fd);
+        return;
+    }
+    uringDrain(reactor, fd);
+
+    // 缓冲区里还有流水线上的请求，没有新数据到来也直接交给线程池
+    if (conn->open && !conn->busy && users[fd].pipelined())
+    {
+        if (!pool->appendP(users + fd)) uringClose(reactor, fd);
+        else conn->busy = true;
+    }
+}
+
+void WebServer::uringClose(subReactor* reactor, int fd)
+{
+    uringConn* conn = uringConns + fd;
+    if (!conn->open) return;
+    conn->open = false;
+    conn->gen ++ ;
+
+    for (size_t i = 0; i < conn->pending.size(); i ++ ) reactor->ring->recycleBuffer(conn->pending[i].first);
+    conn->pending.clear();
+
+    utilTimer* timer = usersTimer[fd].timer;
+    if (timer) reactor->utils.timWheel.deleteTimer(timer);
+    usersTimer[fd].timer = NULL;
+
+    // 先释放这个fd槽上的状态，最后才close：close返回后别的环线程可能立刻accept到同一个fd号
+    users[fd].onClose();
+    httpConnection::userCount--;
+    LOG_INFO("close fd %d", fd);
+
+    // 先shutdown让挂着的recv完成，否则环持有的引用会让套接字一直不释放
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+}
+
+// 处理worker投递回来的事件
+void WebServer::uringWake(subReactor* reactor)
+{
+    std::vector<std::pair<int, int> > queue;
+    reactor->wakePending = false;
+    reactor->notifyLock.lock();
+    queue.swap(reactor->notifyQueue);
+    reactor->notifyLock.unlock();
+
+    for (size_t i = 0; i < queue.size(); i ++ )
+    {
+        int fd = queue[i].first;
+        uringConn* conn = uringConns + fd;
+        if (!conn->open) continue;
+
+        // 请求还没收完整，继续收
+        if (queue[i].second == EPOLLIN)
+        {
+            conn->busy = false;
+            uringDrain(reactor, fd);
+        }
+        else if (queue[i].second == EPOLLOUT) uringSend(reactor, fd);
+        else
+        {
+            conn->busy = false;
+            uringClose(reactor, fd);
+        }
+    }
+}
+
+void WebServer::uringLoop(subReactor* reactor)
+{
+    ioUring* ring = reactor->ring;
+    bool acceptArmed = false;
+    bool wakeArmed = false;
+    bool tickArmed = false;
+
+    while (!stopServer)
+    {
+        // 常驻的accept、eventfd读和定时器在提交队列满时可能没放进去，每轮提交前补上；
+        // 缺了任何一个都不能阻塞等待，否则可能再也没有完成事件把环线程唤醒
+        if (!acceptArmed) acceptArmed = ring->prepAcceptMultishot(reactor->listenFd, uringData(URING_ACCEPT, 0, reactor->listenFd));
+        if (!wakeArmed) wakeArmed = ring->prepRead(reactor->wakeFd, &reactor->wakeBuf, sizeof(reactor->wakeBuf), uringData(URING_WAKE, 0, reactor->wakeFd));
+        if (!tickArmed) tickArmed = ring->prepTimeout(&reactor->tickSpec, uringData(URING_TICK, 0, 0));
+
+        // 完成队列溢出时内核返回EBUSY，资源不足时返回EAGAIN，先收割完成事件再重试，不退出反应堆
+        if (ring->submit(acceptArmed && wakeArmed && tickArmed ? 1 : 0) < 0
+            && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+        {
+            LOG_ERROR("reactor %d: %s", reactor->id, "io_uring_enter failure");
+            break;
+        }
+        coarseClock::update();
+
+        bool recycled = false;
+        io_uring_cqe* cqe;
+        while ((cqe = ring->peekCqe()) != NULL)
+        {
+            int op = cqe->user_data >> 56;
+            unsigned gen = (cqe->user_data >> 32) & 0xffffff;
+            int fd = (int)(uint32_t)cqe->user_data;
+
+            switch (op)
+            {
+            case URING_ACCEPT:
+            {
+                if (cqe->res >= 0) uringAccept(reactor, cqe->res);
+                else LOG_ERROR("%s:errno is:%d", "accept error", -cqe->res);
+                if (!(cqe->flags & IORING_CQE_F_MORE)) acceptArmed = false;
+                break;
+            }
+            case URING_RECV:
+            {
+                // 旧连接的完成事件，只归还缓冲区
+                if (gen != (uringConns[fd].gen & 0xffffff) || !uringConns[fd].open)
+                {
+                    if (cqe->flags & IORING_CQE_F_BUFFER)
+                    {
+                        ring->recycleBuffer(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                        recycled = true;
+                    }
+                    break;
+                }
+                uringRecv(reactor, fd, cqe);
+                recycled = true;
+                break;
+            }
+            case URING_SEND:
+            {
+                if (gen == (uringConns[fd].gen & 0xffffff)) uringSent(reactor, fd, cqe->res);
+                break;
+            }
+            case URING_WAKE:
+            {
+                wakeArmed = false;
+                uringWake(reactor);
+                break;
+            }
+            case URING_TICK:
+            {
+                reactor->utils.timWheel.tick();
+                tickArmed = false;
+                logWakeups(reactor);
+                break;
+            }
+            }
+            ring->seenCqe();
+        }
+
+        // 有缓冲区归还时，重新给因缓冲区耗尽而停掉的连接提交recv
+        if (recycled && !reactor->starved.empty())
+        {
+            std::vector<int> starved;
+            starved.swap(reactor->starved);
+            for (size_t i = 0; i < starved.size(); i ++ ) uringDrain(reactor, starved[i]);
+        }
+
+        // 本轮完成事件投递的任务一起唤醒空闲的工作线程
+        pool->flush();
+    }
+}
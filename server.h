@@ -10,12 +10,74 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <cassert>
+#include <atomic>
+#include <vector>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
 #include "./http/http_conn.h"
+#include "./store/mysql_store.h"
+#include "./store/mmap_store.h"
 #include "./threadpool/threadpool.h"
+#include "./uring/uring.h"
+#include "./clock/coarse_clock.h"
 
 const int MAX_FD = 65536;               // 最大文件描述符
 const int MAX_EVENT_NUMBER = 10000;     // 最大事件数
 const int TIMESLOT = 5;                 // 最小超时单位
+const int TICK_MS = 100;                // 默认每隔多少毫秒处理一次到期的定时器
+const int WAKEUP_STATS_MS = 5000;       // 每隔多少毫秒输出一次线程池的唤醒计数
+const int DB_THREAD_NUM = 2;            // 默认数据库通道的工作线程数
+const int DB_MAX_REQUEST = 1000;        // 数据库通道队列中允许的最大请求数
+const int FILE_CACHE_ENTRIES = 1024;                    // 文件缓存最多缓存的文件数
+const long FILE_CACHE_BYTES = 64L * 1024 * 1024;        // 文件缓存共享映射的总字节数上限
+const long FILE_CACHE_MAP_LIMIT = 1024 * 1024;          // 超过该大小的文件只缓存描述符
+const long RESPONSE_CACHE_FILE_LIMIT = 64 * 1024;       // 不超过该大小的文件缓存完整响应
+const long RESPONSE_CACHE_BYTES = 32L * 1024 * 1024;    // 响应缓存的总字节数上限
+const int URING_ENTRIES = 4096;                         // io_uring提交队列长度
+const int URING_BUF_COUNT = 1024;                       // 每个环提供给多发recv的缓冲区块数，必须是2的幂
+const int URING_BUF_SIZE = 2048;                        // 每块缓冲区大小
+
+class WebServer;
+
+// 反应堆，独占一个epoll实例、一个监听套接字和一个时间轮
+// 单反应堆模式下只有reactors[0]，由主线程驱动
+// 多反应堆模式下每个反应堆一个线程，各自用SO_REUSEPORT监听同一端口，由内核分发新连接
+// users/usersTimer按fd下标访问，fd在进程内唯一，所以每个反应堆只会碰到自己接受的那一部分
+struct subReactor
+{
+    int             id;
+    int             epollFd;
+    int             listenFd;
+    pthread_t       thread;
+    WebServer*      server;
+    Utils           utils;                      // 本反应堆的时间轮
+    int             timerFd;                    // 周期触发的timerfd，注册在本反应堆的epoll中
+    epoll_event     events[MAX_EVENT_NUMBER];
+
+    // io_uring后端，worker处理完请求后把(fd, 事件)放进notifyQueue，再通过wakeFd唤醒环线程
+    ioUring*                            ring;
+    int                                 wakeFd;
+    uint64_t                            wakeBuf;
+    std::atomic<bool>                   wakePending;
+    locker                              notifyLock;
+    std::vector<std::pair<int, int> >   notifyQueue;
+    std::vector<int>                    starved;        // 缓冲区耗尽而停掉recv的连接
+    __kernel_timespec                   tickSpec;
+};
+
+// io_uring后端每个连接在环线程一侧的状态
+struct uringConn
+{
+    subReactor*                         reactor;
+    unsigned                            gen;            // 连接关闭时自增，用来丢弃旧连接的完成事件
+    bool                                open;
+    bool                                busy;           // 请求正在worker中处理或正在发送响应
+    bool                                closing;        // 对端关闭或超时，等busy结束后关闭
+    bool                                recvArmed;      // 多发recv仍然有效
+    msghdr                              msg;
+    std::vector<std::pair<int, int> >   pending;        // busy期间收到的(缓冲区id, 长度)
+};
 
 class WebServer
 {
@@ -26,7 +88,7 @@ class WebServer
         int                 logWrite;
         int                 closeLog;
         int                 actorModel;
-        int                 pipeFd[2];
+        int                 signalFd;
         int                 epollFd;
         httpConnection*     users;
 
@@ -36,20 +98,35 @@ class WebServer
         string              password;
         string              databaseName;
         int                 sqlNum;
+        int                 userCacheSize;      // 大于0时按需查询用户并最多缓存这么多个，为0时启动时加载整张user表
+        string              storePath;          // 不为空时用户保存在这个本地映射文件中，不连接数据库
 
         // 线程池
         threadPool<httpConnection>* pool;
-        int threadNum;
+        int threadNum;                  // 静态通道的工作线程数
+        int dbThreadNum;                // 数据库通道的工作线程数，为0时不单独分通道
 
         // epoll相关
-        epoll_event events[MAX_EVENT_NUMBER];
-
         int listenFd;
         int optLinger;
         int TRIGMode;
         int LISTENTRIGMode;
         int CONNTRIGMode;
 
+        // 反应堆，reactorNum为1时就是原来的单线程事件循环
+        // ioBackend为1时每个反应堆用io_uring代替epoll + read/writev
+        int                 reactorNum;
+        int                 ioBackend;
+        int                 fileSendMode;       // 0为mmap + writev，1为sendfile
+        int                 fileCacheMode;      // 1为开启静态文件缓存
+        int                 responseCacheMode;  // 1为开启小文件完整响应缓存
+        int                 tickMs;             // 定时器检查间隔，毫秒
+        uint64_t            wakeupLogMs;        // 下次输出唤醒计数的时间，只由0号反应堆读写
+        string              cpuList;            // 反应堆和工作线程绑定的CPU列表，为空不绑核
+        uringConn*          uringConns;
+        subReactor*         reactors;
+        std::atomic<bool>   stopServer;
+
         // 定时器
         clientData* usersTimer;
         Utils utils;
@@ -59,19 +136,44 @@ class WebServer
         ~WebServer();
 
         void init(int _port, string _user, string _password, string _databaseName, int _logWrite,
-                  int _optLinger, int _TRIGMode, int _sqlNum, int _threadNum, int _closeLog, int _actorModel);
+                  int _optLinger, int _TRIGMode, int _sqlNum, int _threadNum, int _closeLog, int _actorModel,
+                  int _reactorNum = 1, int _ioBackend = 0, int _fileSendMode = 0,
+                  int _fileCacheMode = 0, int _responseCacheMode = 0, int _tickMs = TICK_MS,
+                  string _cpuList = "", int _dbThreadNum = DB_THREAD_NUM, int _userCacheSize = 0,
+                  string _storePath = "");
 
-        void threadPool();
+        void initThreadPool();
         void sqlPool();
-        void logWrite();
+        void initLog();
         void trigMode();
         void eventListen();
         void eventLoop();
-        void timer(int connfd, struct sockaddr_in client_address);
-        void adjustTimer(utilTimer* timer);
-        void dealTimer(utilTimer* timer, int sockfd);
-        bool dealClientData();
-        bool dealSignal(bool& timeout, bool& stopServer);
-        void dealRead(int sockfd);
-        void dealWrite(int sockfd);
-};
\ No newline at end of file
+        void timer(subReactor* reactor, int connfd, struct sockaddr_in client_address);
+        void adjustTimer(subReactor* reactor, utilTimer* timer);
+        void dealTimer(subReactor* reactor, utilTimer* timer, int sockfd);
+        bool dealClientData(subReactor* reactor);
+        bool dealSignal(bool& stop);
+        void dealRead(subReactor* reactor, int sockfd);
+        void dealWrite(subReactor* reactor, int sockfd);
+
+    private:
+        int  createListenFd(bool reusePort);
+        void dealEvents(subReactor* reactor, int number);
+        void reactorLoop(subReactor* reactor);
+        static void* reactorWorker(void* arg);
+        void logWakeups(subReactor* reactor);
+
+        // io_uring后端
+        void uringListen(subReactor* reactor, ioUring* ring);
+        void uringLoop(subReactor* reactor);
+        void uringAccept(subReactor* reactor, int connfd);
+        void uringRecv(subReactor* reactor, int fd, io_uring_cqe* cqe);
+        void uringSend(subReactor* reactor, int fd);
+        void uringSent(subReactor* reactor, int fd, int res);
+        void uringDrain(subReactor* reactor, int fd);
+        void uringClose(subReactor* reactor, int fd);
+        void uringWake(subReactor* reactor);
+        static void uringNotify(httpConnection* conn, int ev);
+        static void dbResume(httpConnection* conn);
+        static void connClosed(int sockfd);
+};
@@ -0,0 +1,289 @@
+#include "mmap_store.h"
+
+mmapUserStore::mmapUserStore()
+{
+    fd = -1;
+    logFd = -1;
+    base = NULL;
+    mapLen = 0;
+    header = NULL;
+    slots = NULL;
+    mask = 0;
+    logSize = 0;
+    closeLog = 0;
+}
+
+// 正常退出时表已经完整写回，日志可以清空
+mmapUserStore::~mmapUserStore()
+{
+    if (base && logFd >= 0)
+    {
+        lock.lock();
+        Checkpoint();
+        header->clean = 1;
+        msync(base, sizeof(mmapHeader), MS_SYNC);
+        lock.unlock();
+    }
+    if (base) munmap(base, mapLen);
+    if (fd >= 0) close(fd);
+    if (logFd >= 0) close(logFd);
+}
+
+mmapUserStore* mmapUserStore::GetInstance()
+{
+    static mmapUserStore store;
+    return &store;
+}
+
+uint64_t mmapUserStore::hashOf(const char* name, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i ++ )
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+uint32_t mmapUserStore::sumOf(const char* data, size_t len)
+{
+    uint32_t sum = 2166136261U;
+    for (size_t i = 0; i < len; i ++ )
+    {
+        sum ^= (unsigned char)data[i];
+        sum *= 16777619U;
+    }
+    return sum;
+}
+
+bool mmapUserStore::init(const string& _path, int _closeLog, size_t slotNum)
+{
+    path = _path;
+    closeLog = _closeLog;
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        LOG_ERROR("user store: open %s failed, errno is:%d", path.c_str(), errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) return false;
+
+    size_t headLen = sysconf(_SC_PAGESIZE);
+    bool created = st.st_size == 0;
+    if (created)
+    {
+        size_t size = 1;
+        while (size < slotNum) size <<= 1;
+        mapLen = headLen + size * sizeof(mmapSlot);
+        if (ftruncate(fd, mapLen) < 0)
+        {
+            LOG_ERROR("user store: ftruncate %s failed, errno is:%d", path.c_str(), errno);
+            return false;
+        }
+    }
+    else mapLen = st.st_size;
+
+    void* addr = mmap(NULL, mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        LOG_ERROR("user store: mmap %s failed, errno is:%d", path.c_str(), errno);
+        return false;
+    }
+    base = (char*)addr;
+    header = (mmapHeader*)base;
+    slots = (mmapSlot*)(base + headLen);
+
+    if (created)
+    {
+        header->magic = MMAP_STORE_MAGIC;
+        header->version = MMAP_STORE_VERSION;
+        header->slots = (mapLen - headLen) / sizeof(mmapSlot);
+        header->count = 0;
+        header->clean = 1;
+    }
+    uint64_t n = header->slots;
+    if (header->magic != MMAP_STORE_MAGIC || header->version != MMAP_STORE_VERSION || n == 0 || (n & (n - 1)) ||
+        headLen + n * sizeof(mmapSlot) != mapLen)
+    {
+        LOG_ERROR("user store: %s is not a valid store file", path.c_str());
+        munmap(base, mapLen);
+        base = NULL;
+        return false;
+    }
+    mask = n - 1;
+
+    // 上次异常退出时count可能没有写回，重新数一遍
+    if (!header->clean)
+    {
+        uint64_t count = 0;
+        for (uint64_t i = 0; i <= mask; i ++ ) count += slots[i].hash != 0;
+        header->count = count;
+    }
+
+    string logPath = path + ".log";
+    logFd = open(logPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (logFd < 0)
+    {
+        LOG_ERROR("user store: open %s failed, errno is:%d", logPath.c_str(), errno);
+        return false;
+    }
+    Replay();
+
+    header->clean = 0;
+    msync(base, sizeof(mmapHeader), MS_SYNC);
+    LOG_INFO("user store: %s mapped, %lu users, %lu slots", path.c_str(), (unsigned long)header->count, (unsigned long)n);
+    return true;
+}
+
+// 槽的hash最后写入，读者按acquire读到非0的hash时其余字段已经完整
+const mmapSlot* mmapUserStore::Find(const char* name, size_t len, uint64_t hash) const
+{
+    for (uint64_t i = hash & mask; ; i = (i + 1) & mask)
+    {
+        const mmapSlot* slot = slots + i;
+        uint64_t h = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+        if (h == 0) return NULL;
+        if (h == hash && slot->nameLen == len && memcmp(slot->name, name, len) == 0) return slot;
+    }
+}
+
+// 调用时持有lock，并且已确认不存在
+void mmapUserStore::Insert(const char* name, size_t len, const char* passwd, size_t passwdLen, uint64_t hash)
+{
+    uint64_t i = hash & mask;
+    while (slots[i].hash) i = (i + 1) & mask;
+    mmapSlot* slot = slots + i;
+    slot->nameLen = len;
+    slot->passwdLen = passwdLen;
+    memcpy(slot->name, name, len);
+    memcpy(slot->passwd, passwd, passwdLen);
+    __atomic_store_n(&slot->hash, hash, __ATOMIC_RELEASE);
+    header->count ++ ;
+}
+
+// 重放上次检查点之后的注册，已经在表中的跳过；遇到写了一半的记录就截断在那里
+void mmapUserStore::Replay()
+{
+    struct stat st;
+    if (fstat(logFd, &st) < 0 || st.st_size == 0) return;
+
+    string data(st.st_size, '\0');
+    long got = 0;
+    while (got < st.st_size)
+    {
+        int ret = pread(logFd, &data[got], st.st_size - got, got);
+        if (ret <= 0) break;
+        got += ret;
+    }
+
+    long pos = 0;
+    int replayed = 0;
+    while (pos + (long)sizeof(mmapLogRecord) <= got)
+    {
+        mmapLogRecord rec;
+        memcpy(&rec, &data[pos], sizeof(rec));
+        long end = pos + sizeof(rec) + rec.nameLen + rec.passwdLen;
+        if (rec.magic != MMAP_LOG_MAGIC || rec.nameLen == 0 || rec.nameLen > MMAP_NAME_MAX ||
+            rec.passwdLen > MMAP_PASSWD_MAX || end > got)
+        {
+            break;
+        }
+        const char* name = &data[pos + sizeof(rec)];
+        if (sumOf(name, rec.nameLen + rec.passwdLen) != rec.sum) break;
+
+        uint64_t hash = hashOf(name, rec.nameLen);
+        if (!Find(name, rec.nameLen, hash) && header->count <= mask)
+        {
+            Insert(name, rec.nameLen, name + rec.nameLen, rec.passwdLen, hash);
+            replayed ++ ;
+        }
+        pos = end;
+    }
+    if (pos < st.st_size)
+    {
+        LOG_ERROR("user store: log truncated at %ld of %ld bytes", pos, (long)st.st_size);
+        if (ftruncate(logFd, pos) < 0) LOG_ERROR("user store: ftruncate log failed, errno is:%d", errno);
+    }
+    logSize = pos;
+    if (replayed) LOG_INFO("user store: replayed %d registrations from log", replayed);
+}
+
+// 表写回磁盘后日志中的记录都不再需要，调用时持有lock
+void mmapUserStore::Checkpoint()
+{
+    if (msync(base, mapLen, MS_SYNC) < 0)
+    {
+        LOG_ERROR("user store: msync failed, errno is:%d", errno);
+        return;
+    }
+    if (ftruncate(logFd, 0) < 0)
+    {
+        LOG_ERROR("user store: ftruncate log failed, errno is:%d", errno);
+        return;
+    }
+    logSize = 0;
+}
+
+int mmapUserStore::Check(const char* name, const char* passwd)
+{
+    size_t len = strlen(name);
+    const mmapSlot* slot = Find(name, len, hashOf(name, len));
+    if (slot == NULL) return 0;
+    size_t passwdLen = strlen(passwd);
+    return slot->passwdLen == passwdLen && memcmp(slot->passwd, passwd, passwdLen) == 0;
+}
+
+int mmapUserStore::Exists(const char* name)
+{
+    size_t len = strlen(name);
+    return Find(name, len, hashOf(name, len)) != NULL;
+}
+
+int mmapUserStore::Add(const char* name, const char* passwd)
+{
+    size_t len = strlen(name), passwdLen = strlen(passwd);
+    // 超出槽能保存的长度，按注册失败处理
+    if (len == 0 || len > MMAP_NAME_MAX || passwdLen > MMAP_PASSWD_MAX) return 1;
+    uint64_t hash = hashOf(name, len);
+
+    char buf[sizeof(mmapLogRecord) + MMAP_NAME_MAX + MMAP_PASSWD_MAX];
+    mmapLogRecord rec;
+    rec.magic = MMAP_LOG_MAGIC;
+    rec.nameLen = len;
+    rec.passwdLen = passwdLen;
+    memcpy(buf + sizeof(rec), name, len);
+    memcpy(buf + sizeof(rec) + len, passwd, passwdLen);
+    rec.sum = sumOf(buf + sizeof(rec), len + passwdLen);
+    memcpy(buf, &rec, sizeof(rec));
+    size_t recLen = sizeof(rec) + len + passwdLen;
+
+    lock.lock();
+    if (Find(name, len, hash))
+    {
+        lock.unlock();
+        return 1;
+    }
+    if (header->count + 1 > (mask + 1) / 4 * 3)
+    {
+        lock.unlock();
+        LOG_ERROR("user store: %s is full", path.c_str());
+        return -1;
+    }
+
+    // 日志落盘之后才算注册成功
+    if (write(logFd, buf, recLen) != (ssize_t)recLen || fdatasync(logFd) < 0)
+    {
+        LOG_ERROR("user store: write log failed, errno is:%d", errno);
+        if (ftruncate(logFd, logSize) < 0) LOG_ERROR("user store: ftruncate log failed, errno is:%d", errno);
+        lock.unlock();
+        return -1;
+    }
+    logSize += recLen;
+    Insert(name, len, passwd, passwdLen, hash);
+    if (logSize > MMAP_LOG_LIMIT) Checkpoint();
+    lock.unlock();
+    return 0;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <string>
+#include "user_store.h"
+#include "../lock/locker.h"
+#include "../log/log.h"
+
+using namespace std;
+
+const int MMAP_NAME_MAX = 62;                       // 用户名最长字节数
+const int MMAP_PASSWD_MAX = 64;                     // 密码最长字节数
+const size_t MMAP_STORE_SLOTS = 1 << 20;            // 新建存储文件时的槽数，文件是稀疏的，按需占用磁盘
+const long MMAP_LOG_LIMIT = 4L * 1024 * 1024;       // 日志超过这个大小时把表刷到磁盘并清空日志
+const uint32_t MMAP_STORE_MAGIC = 0x52455355;       // "USER"
+const uint32_t MMAP_LOG_MAGIC = 0x474f4c55;         // "ULOG"
+const uint32_t MMAP_STORE_VERSION = 1;
+
+// 存储文件第一页是文件头，后面紧跟slots个槽
+struct mmapHeader
+{
+    uint32_t        magic;
+    uint32_t        version;
+    uint64_t        slots;          // 槽数，2的幂
+    uint64_t        count;          // 已用槽数
+    uint32_t        clean;          // 正常关闭时为1，打开后置0，再次打开时为0说明上次异常退出
+};
+
+struct mmapSlot
+{
+    uint64_t        hash;           // 0表示空槽，其余字段写好之后才写入
+    uint8_t         nameLen;
+    uint8_t         passwdLen;
+    char            name[MMAP_NAME_MAX];
+    char            passwd[MMAP_PASSWD_MAX];
+};
+
+// 日志中的一条注册，后面跟着用户名和密码
+struct mmapLogRecord
+{
+    uint32_t        magic;
+    uint32_t        sum;            // 用户名和密码的校验和，用来识别写了一半的记录
+    uint8_t         nameLen;
+    uint8_t         passwdLen;
+};
+
+// 不依赖数据库的本地用户存储：一个映射到内存的开放寻址哈希文件，加一个只追加的日志
+// 启动时只映射文件，不逐行加载；登录和查重只读映射的内存，不做系统调用，也不加锁
+// 注册先追加日志并fdatasync，再写入映射的表，所以崩溃后重放日志即可恢复没有刷到磁盘的部分
+// 日志超过MMAP_LOG_LIMIT时msync整张表再清空日志
+// 容量在建文件时确定，用掉四分之三后拒绝新注册
+class mmapUserStore : public userStore
+{
+    private:
+        string          path;
+        int             fd;
+        int             logFd;
+        char*           base;
+        size_t          mapLen;
+        mmapHeader*     header;
+        mmapSlot*       slots;
+        uint64_t        mask;
+        long            logSize;
+        locker          lock;           // 只在写入时持有
+
+        mmapUserStore();
+        ~mmapUserStore();
+
+        static uint64_t hashOf(const char* name, size_t len);
+        static uint32_t sumOf(const char* data, size_t len);
+        const mmapSlot* Find(const char* name, size_t len, uint64_t hash) const;
+        void            Insert(const char* name, size_t len, const char* passwd, size_t passwdLen, uint64_t hash);
+        void            Replay();
+        void            Checkpoint();
+
+    public:
+        int             closeLog;
+
+        static mmapUserStore* GetInstance();
+
+        // 文件不存在时按slotNum个槽新建
+        bool            init(const string& _path, int _closeLog, size_t slotNum = MMAP_STORE_SLOTS);
+
+        int             Check(const char* name, const char* passwd);
+        int             Exists(const char* name);
+        int             Add(const char* name, const char* passwd);
+};
@@ -0,0 +1,90 @@
+#include "mysql_store.h"
+
+mysqlUserStore::mysqlUserStore() : connPool(NULL), closeLog(0)
+{
+}
+
+mysqlUserStore* mysqlUserStore::GetInstance()
+{
+    static mysqlUserStore store;
+    return &store;
+}
+
+void mysqlUserStore::init(connectionPool* _connPool, int sqlNum, long cacheSize, int _closeLog)
+{
+    connPool = _connPool;
+    closeLog = _closeLog;
+
+    // 按需查询模式下不加载整张表，启动时间与表的大小无关
+    if (cacheSize > 0) credentialCache::GetInstance()->init(connPool, cacheSize, closeLog);
+    else LoadAll();
+
+    // 注册的INSERT交给组提交写入器批量执行，写入器队列满时再交给异步执行器，执行线程数与连接池大小相同
+    if (!sqlBatchWriter::GetInstance()->init(connPool, closeLog)) LOG_ERROR("%s", "sql batch writer init failure");
+    if (!sqlExecutor::GetInstance()->init(connPool, sqlNum)) LOG_ERROR("%s", "sql executor init failure");
+}
+
+void mysqlUserStore::LoadAll()
+{
+    // 从连接池中取一个连接
+    MYSQL* mysql = NULL;
+    connectionRAII mysqlCon(&mysql, connPool);
+
+    // 在user表中检索username，passwd数据，查询成功返回0
+    if (mysql_query(mysql, "SELECT username, passwd FROM user"))
+    {
+        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+    }
+    // 从表中检索完整的结果集
+    MYSQL_RES* result = mysql_store_result(mysql);
+    // 返回结果集中的列数
+    int numFields = mysql_num_fields(result);
+    // 返回所有字段结构的数组
+    MYSQL_FIELD* fields = mysql_fetch_fields(result);
+    // 从结果集中获取下一行，将对应的用户名和密码，存入userCache中
+    while (MYSQL_ROW row = mysql_fetch_row(result))
+    {
+        userCache::GetInstance()->Insert(row[0], row[1]);
+    }
+    mysql_free_result(result);
+}
+
+int mysqlUserStore::Check(const char* name, const char* passwd)
+{
+    if (credentialCache::GetInstance()->on()) return credentialCache::GetInstance()->Check(name, passwd);
+    return userCache::GetInstance()->Check(name, passwd);
+}
+
+int mysqlUserStore::Exists(const char* name)
+{
+    if (credentialCache::GetInstance()->on()) return credentialCache::GetInstance()->Exists(name);
+    return userCache::GetInstance()->Contains(name);
+}
+
+int mysqlUserStore::Add(const char* name, const char* passwd)
+{
+    MYSQL* mysql = NULL;
+    connectionRAII mysqlConn(&mysql, connPool, SQL_WAIT_MS);
+    if (mysql == NULL) return -1;
+
+    string params[2] = {name, passwd};
+    int res = mysqlConn.Execute(STMT_USER_INSERT, params, 2);
+    if (!res) Added(name, passwd);
+    return res;
+}
+
+// 优先交给组提交写入器，队列满时退回sqlExecutor单条执行
+bool mysqlUserStore::Submit(sqlTask* task, const char* name, const char* passwd)
+{
+    task->stmt = STMT_USER_INSERT;
+    task->params.assign(2, string());
+    task->params[0] = name;
+    task->params[1] = passwd;
+    return sqlBatchWriter::GetInstance()->submit(task) || sqlExecutor::GetInstance()->submit(task);
+}
+
+void mysqlUserStore::Added(const char* name, const char* passwd)
+{
+    if (credentialCache::GetInstance()->on()) credentialCache::GetInstance()->Added(name, passwd);
+    else userCache::GetInstance()->Insert(name, passwd);
+}
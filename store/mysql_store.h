@@ -0,0 +1,37 @@
+#pragma once
+
+
+#include <mysql/mysql.h>
+#include "user_store.h"
+#include "../log/log.h"
+#include "../CGImysql/sql_connection.h"
+#include "../CGImysql/sql_executor.h"
+#include "../CGImysql/sql_batch_writer.h"
+#include "../cache/user_cache.h"
+#include "../cache/credential_cache.h"
+
+// 用户保存在MySQL的user表中
+// cacheSize为0时启动时把整张表加载进userCache，否则按需查询并由credentialCache缓存
+// 注册交给组提交写入器异步执行，写入器队列满时交给sqlExecutor
+class mysqlUserStore : public userStore
+{
+    private:
+        connectionPool*     connPool;
+
+        mysqlUserStore();
+
+        void                LoadAll();
+
+    public:
+        int                 closeLog;
+
+        static mysqlUserStore* GetInstance();
+
+        void                init(connectionPool* _connPool, int sqlNum, long cacheSize, int _closeLog);
+
+        int                 Check(const char* name, const char* passwd);
+        int                 Exists(const char* name);
+        int                 Add(const char* name, const char* passwd);
+        bool                Submit(sqlTask* task, const char* name, const char* passwd);
+        void                Added(const char* name, const char* passwd);
+};
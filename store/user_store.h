@@ -0,0 +1,21 @@
+#pragma once
+
+
+#include "../CGImysql/sql_executor.h"
+
+// 登录和注册背后的用户存储，doRequest只通过这个接口访问用户
+// 返回int的查询接口：1为是，0为否，-1表示存储暂时不可用
+class userStore
+{
+    public:
+        virtual ~userStore() {}
+
+        virtual int     Check(const char* name, const char* passwd) = 0;
+        virtual int     Exists(const char* name) = 0;
+        // 同步写入，返回0成功，-1存储不可用，其余为错误码（如用户名重复）
+        virtual int     Add(const char* name, const char* passwd) = 0;
+        // 交给后台异步写入，结果在task->done中返回；不支持异步或队列已满时返回false，由调用者改用Add
+        virtual bool    Submit(sqlTask* task, const char* name, const char* passwd) { return false; }
+        // 异步写入成功后由回调调用，更新存储自己的缓存
+        virtual void    Added(const char* name, const char* passwd) {}
+};
@@ -1,55 +1,219 @@
 #pragma once
 
 
-#include <list>
 #include <cstdio>
+#include <atomic>
 #include <exception>
 #include <stdexcept>
+#include <climits>
+#include <vector>
+#include <sched.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "../lock/locker.h"
-#include "../CGImysql/sql_connection.h"
+#include "../affinity/cpu_affinity.h"
+
+const int WORKER_SPIN_MIN = 64;         // 空闲线程睡眠前自旋检查队列的次数下限
+const int WORKER_SPIN_MAX = 4096;       // 上限
+
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// 每个工作线程一个有界的无锁环形队列(多生产者多消费者)，容量为2的幂，构造时一次分配好
+// 每个槽带一个序号，生产者和消费者各自用CAS推进tail和head，不需要互斥锁，入队也不再分配内存
+template <typename T>
+struct workQueue
+{
+    struct cell
+    {
+        std::atomic<unsigned>   seq;
+        T*                      request;
+    };
+
+    cell*                   cells;
+    unsigned                mask;
+    char                    pad0[64];       // head和tail分别放在独立的缓存行上，生产者和消费者互不干扰
+    std::atomic<unsigned>   head;
+    char                    pad1[64];
+    std::atomic<unsigned>   tail;
+    char                    pad2[64];
+
+    workQueue() : cells(NULL), mask(0), head(0), tail(0) {}
+    ~workQueue() { delete[] cells; }
+
+    void init(unsigned capacity)
+    {
+        unsigned cap = 1;
+        while (cap < capacity) cap <<= 1;
+        cells = new cell[cap];
+        for (unsigned i = 0; i < cap; i ++ ) cells[i].seq.store(i, std::memory_order_relaxed);
+        mask = cap - 1;
+    }
+
+    // 队列满返回false
+    bool push(T* request)
+    {
+        unsigned pos = tail.load(std::memory_order_relaxed);
+        cell* c;
+        while (true)
+        {
+            c = cells + (pos & mask);
+            int diff = (int)(c->seq.load(std::memory_order_acquire) - pos);
+            if (diff == 0)
+            {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) return false;
+            else pos = tail.load(std::memory_order_relaxed);
+        }
+        c->request = request;
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 队列空返回NULL，本线程和来偷任务的线程都从队头取
+    T* pop()
+    {
+        unsigned pos = head.load(std::memory_order_relaxed);
+        cell* c;
+        while (true)
+        {
+            c = cells + (pos & mask);
+            int diff = (int)(c->seq.load(std::memory_order_acquire) - (pos + 1));
+            if (diff == 0)
+            {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) return NULL;
+            else pos = head.load(std::memory_order_relaxed);
+        }
+        T* request = c->request;
+        c->seq.store(pos + mask + 1, std::memory_order_release);
+        return request;
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+};
+
+// 调度通道：静态文件请求和要访问数据库的请求(登录、注册)各用一组工作线程和队列
+// 两个通道互不偷任务，数据库慢的时候静态请求照常处理
+enum POOL_LANE
+{
+    LANE_STATIC = 0,
+    LANE_DB,
+    LANE_NUM
+};
+
+struct workLane
+{
+    int                 begin;          // 本通道的工作线程下标为[begin, end)
+    int                 end;
+    int                 maxRequest;     // 本通道所有队列中允许的最大请求数
+    std::atomic<int>    wakeSeq;        // 本通道的空闲线程在这个字上futex等待，唤醒时先加1
+    std::atomic<int>    sleepers;       // 正在或即将futex等待的线程数
+    std::vector<std::vector<int> >  homeWorkers;    // 下标为NUMA节点，该节点上属于本通道的工作线程
+    char                pad[64];
+
+    workLane() : begin(0), end(0), maxRequest(0), wakeSeq(0), sleepers(0) {}
+};
 
 template <typename T>
 class threadPool
 {
     private:
-        int                 threadNumer;    // 线程池中的线程数
-        int                 maxRequest;     // 请求队列中允许的最大请求数
+        int                 threadNumber;   // 两个通道的工作线程总数
         pthread_t*          threads;        // 描述线程池的数组，其大小为threadNumber
-        std::list<T*>       workQueue;      // 请求队列
-        locker              queueLocker;    // 保护请求队列的互斥锁
-        sem                 queueState;     // 是否有任务需要处理
-        connectionPool*     connPool;       // 数据库连接池
+        workQueue<T>*       queues;         // 每个线程一个任务队列
+        workLane            lanes[LANE_NUM];
+        std::vector<std::vector<int> >  stealOrder;     // 每个线程偷任务时依次查看的同通道队列，同节点的在前
+        std::atomic<int>    nextWorker;     // 线程启动时依次领取自己的队列下标
+        std::atomic<int>    running;        // 还没退出的工作线程数
+        std::atomic<bool>   stopped;        // 析构时置位，工作线程处理完手头的任务后退出
+        std::atomic<unsigned long>  wakeCalls;      // 唤醒用的futex系统调用次数
+        std::atomic<unsigned long>  wakeBatches;    // 投递过任务的批次数
         int                 actorModel;     // 模型切换
 
+        static thread_local int pendingWake[LANE_NUM];  // 本线程自上次flush以来向各通道投递的任务数
+
         static void* worker(void* arg);
         void run();
+        void placeWorkers();
+        int laneOf(T* request);
+        int laneOfWorker(int self) const { return self < lanes[LANE_DB].begin ? LANE_STATIC : LANE_DB; }
+        bool push(T* request, int lane);
+        bool handoff(T* request, int self);
+        T* take(int self);
+        bool hasWork(const workLane& lane);
+        void park(workLane& lane, int& spin);
 
     public:
-        threadPool(int _actorModel, connectionPool* _connPool, int _threadNumber = 8, int _maxRequest = 10000);
+        // dbThreadNumber为0时不单独开数据库通道，所有请求共用静态通道
+        threadPool(int _actorModel, int _threadNumber = 8, int _maxRequest = 10000,
+                   int _dbThreadNumber = 0, int _dbMaxRequest = 1000);
         ~threadPool();
         bool append(T* request, int state); // 添加任务
         bool appendP(T* request);
+        void flush();                       // 一批任务投递完后调用，每个通道最多一次系统调用唤醒空闲线程
+        // 工作线程取到任务后才读actorModel，只能在投递第一个任务之前修改
+        void setActorModel(int _actorModel) { actorModel = _actorModel; }
+        unsigned long wakeupCalls() const { return wakeCalls.load(std::memory_order_relaxed); }
+        unsigned long wakeupBatches() const { return wakeBatches.load(std::memory_order_relaxed); }
 };
 
 template <typename T>
-threadPool<T>::threadPool(int _actorModel, connectionPool* _connPool, int _threadNumber, int _maxRequest) :
-            actorModel(_actorModel), threadNumber(_threadNumber), maxRequest(_maxRequest), threads(NULL), connPool(_connPool)
+thread_local int threadPool<T>::pendingWake[LANE_NUM] = {0};
+
+template <typename T>
+threadPool<T>::threadPool(int _actorModel, int _threadNumber, int _maxRequest,
+                          int _dbThreadNumber, int _dbMaxRequest) :
+            threadNumber(_threadNumber + (_dbThreadNumber > 0 ? _dbThreadNumber : 0)), threads(NULL), queues(NULL),
+            nextWorker(0), running(0), stopped(false), wakeCalls(0), wakeBatches(0), actorModel(_actorModel)
 {
     if (_threadNumber <= 0 || _maxRequest <= 0) {
         throw std::invalid_argument("Thread number and max request must be greater than 0");
     }
-    threads = new pthread_t[_threadNumber];
+    if (_dbThreadNumber > 0 && _dbMaxRequest <= 0) {
+        throw std::invalid_argument("Database lane max request must be greater than 0");
+    }
+    threads = new pthread_t[threadNumber];
     if (!threads) {
         throw std::bad_alloc();
     }
 
-    for (int i = 0; i < _threadNumber; i++) {
+    // 静态通道占前_threadNumber个线程，数据库通道接在后面；没有数据库通道时它是一个空区间
+    lanes[LANE_STATIC].begin = 0;
+    lanes[LANE_STATIC].end = _threadNumber;
+    lanes[LANE_STATIC].maxRequest = _maxRequest;
+    lanes[LANE_DB].begin = _threadNumber;
+    lanes[LANE_DB].end = threadNumber;
+    lanes[LANE_DB].maxRequest = _dbMaxRequest;
+
+    // 每个通道的容量平均分给通道内各线程的队列
+    queues = new workQueue<T>[threadNumber];
+    for (int l = 0; l < LANE_NUM; l ++ ) {
+        int n = lanes[l].end - lanes[l].begin;
+        for (int i = lanes[l].begin; i < lanes[l].end; i++) {
+            queues[i].init((lanes[l].maxRequest + n - 1) / n);
+        }
+    }
+    placeWorkers();
+
+    for (int i = 0; i < threadNumber; i++) {
         // 创建线程，如果失败则抛出异常
         if (pthread_create(threads + i, NULL, worker, this) != 0) {
             delete[] threads;
             throw std::runtime_error("Failed to create thread");
         }
+        running ++ ;
         // 分离线程，成功返回0，如果失败则抛出异常
         if (pthread_detach(threads[i])) {
             delete[] threads;
@@ -61,41 +225,188 @@ threadPool<T>::threadPool(int _actorModel, connectionPool* _connPool, int _threa
 template <typename T>
 threadPool<T>::~threadPool()
 {
+    // 工作线程会自旋访问队列，必须等它们全部退出后才能释放
+    stopped.store(true);
+    for (int l = 0; l < LANE_NUM; l ++ )
+    {
+        lanes[l].wakeSeq.fetch_add(1);
+        syscall(SYS_futex, &lanes[l].wakeSeq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+    while (running.load() > 0) sched_yield();
+
     delete[] threads;
+    delete[] queues;
 }
 
+// 按绑核策略把工作线程分到各NUMA节点，没有开启绑核时所有线程都算在节点0
 template <typename T>
-bool threadPool<T>::append(T* request, int state)
+void threadPool<T>::placeWorkers()
 {
-    queueLocker.lock();
-    if (workQueue.size() >= maxRequest)
+    cpuAffinity* affinity = cpuAffinity::GetInstance();
+    std::vector<int> node(threadNumber, 0);
+    for (int i = 0; i < threadNumber; i ++ )
     {
-        queueLocker.unlock();
-        return false;
+        if (affinity->on()) node[i] = affinity->nodeOf(affinity->workerCpu(i));
+    }
+
+    for (int l = 0; l < LANE_NUM; l ++ )
+    {
+        workLane& lane = lanes[l];
+        lane.homeWorkers.assign(AFFINITY_NODE_MAX, std::vector<int>());
+        for (int i = lane.begin; i < lane.end; i ++ ) lane.homeWorkers[node[i]].push_back(i);
+        // 没有本通道工作线程的节点上的反应堆只能把任务交给本通道的所有线程
+        for (int n = 0; n < AFFINITY_NODE_MAX; n ++ )
+        {
+            if (!lane.homeWorkers[n].empty()) continue;
+            for (int i = lane.begin; i < lane.end; i ++ ) lane.homeWorkers[n].push_back(i);
+        }
+    }
+
+    stealOrder.assign(threadNumber, std::vector<int>());
+    for (int self = 0; self < threadNumber; self ++ )
+    {
+        const workLane& lane = lanes[laneOfWorker(self)];
+        int n = lane.end - lane.begin;
+        for (int pass = 0; pass < 2; pass ++ )
+        {
+            for (int i = 1; i < n; i ++ )
+            {
+                int victim = lane.begin + (self - lane.begin + i) % n;
+                if ((node[victim] == node[self]) == (pass == 0)) stealOrder[self].push_back(victim);
+            }
+        }
+    }
+}
+
+// 没有数据库通道时所有请求都走静态通道
+template <typename T>
+int threadPool<T>::laneOf(T* request)
+{
+    if (lanes[LANE_DB].end == lanes[LANE_DB].begin) return LANE_STATIC;
+    return request->dbBound() ? LANE_DB : LANE_STATIC;
+}
+
+// 同一个连接总是先推到反应堆所在节点上的同一个线程，连接的数据留在该线程的缓存里；队列满了依次换通道内下一个
+// 这里只入队不唤醒，唤醒留到flush里按批次做
+template <typename T>
+bool threadPool<T>::push(T* request, int lane)
+{
+    const workLane& l = lanes[lane];
+    int n = l.end - l.begin;
+    size_t slot = (size_t)request / sizeof(T);
+    const std::vector<int>& home = l.homeWorkers[cpuAffinity::currentNode()];
+    int start = home[slot % home.size()] - l.begin;
+    for (int i = 0; i < n; i ++ )
+    {
+        if (queues[l.begin + (start + i) % n].push(request))
+        {
+            pendingWake[lane] ++ ;
+            return true;
+        }
     }
+    return false;
+}
 
+template <typename T>
+bool threadPool<T>::append(T* request, int state)
+{
     request->state = state;
-    workQueue.push_back(request);
-    queueLocker.unlock();
-    queueState.post();  // 信号量+1
-    return true;
+    return push(request, laneOf(request));
 }
 
 template <typename T>
 bool threadPool<T>::appendP(T* request)
 {
-    queueLocker.lock();
-    if (workQueue.size() >= maxRequest)
+    return push(request, laneOf(request));
+}
+
+// reactor模式下读事件投递时数据还没读，由静态通道的线程读完后才知道路由
+// 要访问数据库的请求转交给数据库通道，state置为2表示数据已读入只需处理；数据库通道满了就留在本线程处理
+template <typename T>
+bool threadPool<T>::handoff(T* request, int self)
+{
+    if (laneOfWorker(self) != LANE_STATIC || laneOf(request) != LANE_DB) return false;
+    request->state = 2;
+    if (!push(request, LANE_DB))
     {
-        queueLocker.unlock();
+        request->state = 0;
         return false;
     }
-    workQueue.push_back(request);
-    queueLocker.unlock();
-    queueState.post();  // 信号量+1
+    flush();
     return true;
 }
 
+// 与park配对：先发布任务再读sleepers，park先加sleepers再检查队列，两边都是顺序一致的
+// 所以要么这里看到有线程在等，要么等待的线程自己看到新任务
+template <typename T>
+void threadPool<T>::flush()
+{
+    for (int l = 0; l < LANE_NUM; l ++ )
+    {
+        if (pendingWake[l] == 0) continue;
+        int n = pendingWake[l];
+        pendingWake[l] = 0;
+        wakeBatches.fetch_add(1, std::memory_order_relaxed);
+
+        workLane& lane = lanes[l];
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int idle = lane.sleepers.load(std::memory_order_seq_cst);
+        if (idle == 0) continue;
+
+        lane.wakeSeq.fetch_add(1, std::memory_order_seq_cst);
+        syscall(SYS_futex, &lane.wakeSeq, FUTEX_WAKE_PRIVATE, n < idle ? n : idle, NULL, NULL, 0);
+        wakeCalls.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+bool threadPool<T>::hasWork(const workLane& lane)
+{
+    for (int i = lane.begin; i < lane.end; i ++ )
+    {
+        if (!queues[i].empty()) return true;
+    }
+    return false;
+}
+
+// 先取自己队列里的任务，没有再从同通道其他线程的队列偷，同节点的线程优先，都没有返回NULL
+template <typename T>
+T* threadPool<T>::take(int self)
+{
+    T* request = queues[self].pop();
+    if (request) return request;
+
+    const std::vector<int>& victims = stealOrder[self];
+    for (size_t i = 0; i < victims.size(); i ++ )
+    {
+        request = queues[victims[i]].pop();
+        if (request) return request;
+    }
+    return NULL;
+}
+
+// 没有任务时先自旋一会儿，仍然没有再futex睡眠
+// 自旋期间等到了任务就把自旋上限加倍，白白自旋后睡眠就减半，任务密集时基本不进内核
+template <typename T>
+void threadPool<T>::park(workLane& lane, int& spin)
+{
+    for (int i = 0; i < spin; i ++ )
+    {
+        if (hasWork(lane))
+        {
+            spin = spin * 2 > WORKER_SPIN_MAX ? WORKER_SPIN_MAX : spin * 2;
+            return;
+        }
+        cpuRelax();
+    }
+    spin = spin / 2 < WORKER_SPIN_MIN ? WORKER_SPIN_MIN : spin / 2;
+
+    int seq = lane.wakeSeq.load(std::memory_order_seq_cst);
+    lane.sleepers.fetch_add(1, std::memory_order_seq_cst);
+    if (!hasWork(lane) && !stopped.load()) syscall(SYS_futex, &lane.wakeSeq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+    lane.sleepers.fetch_sub(1, std::memory_order_seq_cst);
+}
+
 template <typename T>
 void* threadPool<T>::worker(void* arg)
 {
@@ -107,56 +418,46 @@ void* threadPool<T>::worker(void* arg)
 template <typename T>
 void threadPool<T>::run()
 {
-    while (true)
+    int self = nextWorker ++ ;
+    workLane& lane = lanes[laneOfWorker(self)];
+    cpuAffinity::GetInstance()->pinWorker(self);
+    int spin = WORKER_SPIN_MIN;
+    while (!stopped.load())
     {
-        queueState.wait();  // 信号量-1
-        queueLocker.lock();
-        if (workQueue.empty())
+        T* request = take(self);
+        if (!request)
         {
-            queueLocker.unlock;
+            park(lane, spin);
             continue;
         }
 
-        T* request = workQueue.front();
-        workQueue.pop_front();
-        queueLocker.unlock();
-
-        if (!request)   continue;
         if (actorModel == 1)
         {
             // 读写模式
-            if (request->state == 0)
+            if (request->state == 0 || request->state == 2)
             {
-                if (request->readOnce())
+                if (request->state == 2 || request->readOnce())
                 {
-                    request->improv = 1;
-                    connectionRAII mysqlConn(&request->mysql, connPool);
+                    if (request->state == 0 && handoff(request, self)) continue;
                     request->process();
                 }
-                else
-                {
-                    request->improv = 1;
-                    request->timerFlag = 1;     // 读取失败，关闭定时器
-                }
+                // 读取失败，交给反应堆关闭连接并摘掉定时器
+                else request->hangUp();
             }
             else
             {
                 if (request->write())
                 {
-                    request->improv = 1;
-                }
-                else
-                {
-                    request->improv = 1;
-                    request->timerFlag = 1;     // 写入失败，关闭定时器
+                    // 缓冲区里还有流水线上的请求，接着处理；和读路径一样，要访问数据库的先转交给数据库通道
+                    if (request->pipelined() && handoff(request, self)) continue;
+                    if (request->pipelined()) request->process();
                 }
+                // 写入失败或者短连接已发送完，同样交给反应堆关闭
+                else request->hangUp();
             }
         }
-        else
-        // 直接获取数据库连接
-        {
-            connectionRAII mysqlConn(&request->mysql, connPool);
-            request->process();
-        }
+        // 数据库连接由需要写库的请求在doRequest中自己获取
+        else request->process();
     }
-}
\ No newline at end of file
+    running -- ;
+}
@@ -1,149 +1,7 @@
 #include "timer.h"
 #include "../http/http_conn.h"
 
-timerList::timerList()
-{
-    head = NULL;
-    tail = NULL;
-}
-timerList::~timerList()
-{
-    utilTimer *tmp = head;
-    while (tmp)
-    {
-        head = tmp->next;
-        delete tmp;
-        tmp = head;
-    }
-}
-
-void timerList::addTimer(utilTimer *timer)
-{
-    if (!timer)
-    {
-        return;
-    }
-    if (!head)
-    {
-        head = tail = timer;
-        return;
-    }
-    if (timer->expireTime < head->expireTime)
-    {
-        timer->next = head;
-        head->prev = timer;
-        head = timer;
-        return;
-    }
-    addTimer(timer, head);
-}
-void timerList::adjustTimer(utilTimer *timer)
-{
-    if (!timer)
-    {
-        return;
-    }
-    utilTimer *tmp = timer->next;
-    if (!tmp || (timer->expireTime < tmp->expireTime))
-    {
-        return;
-    }
-    if (timer == head)
-    {
-        head = head->next;
-        head->prev = NULL;
-        timer->next = NULL;
-        addTimer(timer, head);
-    }
-    else
-    {
-        timer->prev->next = timer->next;
-        timer->next->prev = timer->prev;
-        addTimer(timer, timer->next);
-    }
-}
-void timerList::deleteTimer(utilTimer *timer)
-{
-    if (!timer)
-    {
-        return;
-    }
-    if ((timer == head) && (timer == tail))
-    {
-        delete timer;
-        head = NULL;
-        tail = NULL;
-        return;
-    }
-    if (timer == head)
-    {
-        head = head->next;
-        head->prev = NULL;
-        delete timer;
-        return;
-    }
-    if (timer == tail)
-    {
-        tail = tail->prev;
-        tail->next = NULL;
-        delete timer;
-        return;
-    }
-    timer->prev->next = timer->next;
-    timer->next->prev = timer->prev;
-    delete timer;
-}
-void timerList::tick()
-{
-    if (!head)
-    {
-        return;
-    }
-    
-    time_t cur = time(NULL);
-    utilTimer *tmp = head;
-    while (tmp)
-    {
-        if (cur < tmp->expireTime)
-        {
-            break;
-        }
-        tmp->callBack(tmp->userData);
-        head = tmp->next;
-        if (head)
-        {
-            head->prev = NULL;
-        }
-        delete tmp;
-        tmp = head;
-    }
-}
-
-void timerList::addTimer(utilTimer *timer, utilTimer *lst_head)
-{
-    utilTimer *prev = lst_head;
-    utilTimer *tmp = prev->next;
-    while (tmp)
-    {
-        if (timer->expireTime < tmp->expireTime)
-        {
-            prev->next = timer;
-            timer->next = tmp;
-            tmp->prev = timer;
-            timer->prev = prev;
-            break;
-        }
-        prev = tmp;
-        tmp = tmp->next;
-    }
-    if (!tmp)
-    {
-        prev->next = timer;
-        timer->prev = prev;
-        timer->next = NULL;
-        tail = timer;
-    }
-}
+void (*Utils::onClose)(int sockfd) = NULL;
 
 void Utils::init(int timeslot)
 {
@@ -176,16 +34,6 @@ void Utils::addFd(int epollfd, int fd, bool one_shot, int TRIGMode)
     setNonBlocking(fd);
 }
 
-//信号处理函数
-void Utils::sigHandler(int sig)
-{
-    //为保证函数的可重入性，保留原来的errno
-    int save_errno = errno;
-    int msg = sig;
-    send(pipeFd[1], (char *)&msg, 1, 0);
-    errno = save_errno;
-}
-
 //设置信号函数
 void Utils::addSig(int sig, void(handler)(int), bool restart)
 {
@@ -198,11 +46,27 @@ void Utils::addSig(int sig, void(handler)(int), bool restart)
     assert(sigaction(sig, &sa, NULL) != -1);
 }
 
-//定时处理任务，重新定时以不断触发SIGALRM信号
-void Utils::timerHandler()
+//创建每隔intervalMs毫秒触发一次的timerfd，直接注册进epoll，不再依赖SIGALRM
+int Utils::createTickFd(int intervalMs)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = intervalMs / 1000;
+    spec.it_interval.tv_nsec = (long)(intervalMs % 1000) * 1000000;
+    spec.it_value = spec.it_interval;
+    timerfd_settime(fd, 0, &spec, NULL);
+    return fd;
+}
+
+//timerfd可读时处理到期的定时器，读走到期次数，否则LT模式下会一直就绪
+void Utils::timerHandler(int tickFd)
 {
-    timLst.tick();
-    alarm(TIMESLOT);
+    uint64_t expirations;
+    while (read(tickFd, &expirations, sizeof(expirations)) > 0);
+    timWheel.tick();
 }
 
 void Utils::showError(int connfd, const char *info)
@@ -211,14 +75,12 @@ void Utils::showError(int connfd, const char *info)
     close(connfd);
 }
 
-int *Utils::pipeFd = 0;
-int Utils::epollFd = 0;
-
 class Utils;
 void callBack(clientData *user_data)
 {
-    epoll_ctl(Utils::epollFd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
+    epoll_ctl(user_data->epollFd, EPOLL_CTL_DEL, user_data->sockfd, 0);
+    if (Utils::onClose) Utils::onClose(user_data->sockfd);
     close(user_data->sockfd);
     httpConnection::userCount--;
 }
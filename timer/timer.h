@@ -18,56 +18,72 @@
 #include <sys/mman.h>
 #include <sys/wait.h>
 #include <time.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
 #include "../log/log.h"
+#include "../clock/coarse_clock.h"
 
-// 定时器类
-class utilTimer;
-
-struct clientData
-{
-    sockaddr_in address;
-    int sockfd;
-    utilTimer* timer;
-};
-
-void callBack(clientData* userData);
+struct clientData;
 
+// 定时器节点，直接嵌在每个连接的clientData里，不再单独new/delete
+// 在时间轮的某个槽的双向链表上时next不为NULL
 class utilTimer
 {
     public:
-        time_t      expireTime;
+        uint64_t    expireTime;              // 到期时间，coarseClock::nowMs()的毫秒数
         clientData* userData;                // 客户数据
         utilTimer*  prev;                    // 前面的utilTimer
         utilTimer*  next;                    // 后面的utilTimer
         void (*callBack)(clientData*);       // 定时器回调函数
 
-        utilTimer() : prev(NULL), next(NULL) {}
+        utilTimer() : expireTime(0), userData(NULL), prev(NULL), next(NULL), callBack(NULL) {}
 };
 
-// 定时器链表
-class timerList
+struct clientData
+{
+    sockaddr_in address;
+    int epollFd;                            // 连接所属反应堆的epoll实例
+    int sockfd;
+    utilTimer* timer;                       // 正在计时时指向node，否则为NULL
+    utilTimer node;
+};
+
+void callBack(clientData* userData);
+
+static const int WHEEL_ROOT_BITS = 8;                       // 第一层256个槽，每槽1毫秒
+static const int WHEEL_LEVEL_BITS = 6;                      // 上面每层64个槽，每层的槽宽是下一层一圈的长度
+static const int WHEEL_LEVELS = 4;                          // 上面的层数，最长约49天
+static const int WHEEL_ROOT_SIZE = 1 << WHEEL_ROOT_BITS;
+static const int WHEEL_LEVEL_SIZE = 1 << WHEEL_LEVEL_BITS;
+
+// 分层时间轮，毫秒精度，添加、刷新、删除定时器都是O(1)
+// 与内核的定时器轮相同：到期时间离当前越远放得越高，低层转完一圈时把高一层对应槽里的定时器重新分散下来
+class timerWheel
 {
     private:
-        utilTimer* head;
-        utilTimer* tail;
-        void addTimer(utilTimer* timer, utilTimer* listHead);
+        uint64_t    current;                                // 下一个要处理的毫秒
+        int         count;                                  // 轮上的定时器个数
+        utilTimer   root[WHEEL_ROOT_SIZE];                  // 各槽链表的哨兵
+        utilTimer   levels[WHEEL_LEVELS][WHEEL_LEVEL_SIZE];
+
+        void        place(utilTimer* timer);
+        void        unlink(utilTimer* timer);
+        int         cascade(int level);
 
     public:
-        timerList();
-        ~timerList();
+        timerWheel();
+        ~timerWheel() {}
 
         void addTimer(utilTimer* timer);        // 添加定时器
-        void adjustTimer(utilTimer* timer);     // 调整定时器
+        void adjustTimer(utilTimer* timer);     // 调整定时器，按新的expireTime换槽
         void deleteTimer(utilTimer* timer);     // 删除定时器
-        void tick();                            // 每次被调用，就会处理链表上到期的定时器
+        void tick();                            // 每次被调用，就会处理轮上到期的定时器
 };
 
 class Utils
 {
     public:
-        static int*   pipeFd;
-        timerList     timLst;
-        static int    epollFd;
+        timerWheel    timWheel;
         int           TIMESLOT;
 
         Utils()  {}
@@ -75,8 +91,10 @@ class Utils
         void          init(int timeslot);
         int           setNonBlocking(int fd);
         void          addFd(int epollFd, int fd, bool oneShot, int TRIGMode);
-        static void   sigHandler(int sig);
         void          addSig(int sig, void(handler)(int), bool restart = true);
-        void          timerHandler();
+        static int    createTickFd(int intervalMs);
+        void          timerHandler(int tickFd);
         void          showError(int connfd, const char* info);
+
+        static void   (*onClose)(int sockfd);      // 定时器关闭连接时在close之前调用，由服务器清理这个fd槽上的连接
 };
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include "timer.h"
+
+timerWheel::timerWheel()
+{
+    coarseClock::refresh();
+    current = coarseClock::nowMs();
+    count = 0;
+    for (int i = 0; i < WHEEL_ROOT_SIZE; i ++ ) root[i].prev = root[i].next = &root[i];
+    for (int i = 0; i < WHEEL_LEVELS; i ++ )
+    {
+        for (int j = 0; j < WHEEL_LEVEL_SIZE; j ++ ) levels[i][j].prev = levels[i][j].next = &levels[i][j];
+    }
+}
+
+// 按离current的远近选槽，挂到槽链表尾部
+void timerWheel::place(utilTimer *timer)
+{
+    uint64_t expire = timer->expireTime;
+    if (expire < current) expire = current;     // 已经到期的放进下一个要处理的槽
+    uint64_t delta = expire - current;
+
+    utilTimer *head;
+    if (delta < WHEEL_ROOT_SIZE) head = &root[expire & (WHEEL_ROOT_SIZE - 1)];
+    else
+    {
+        int level = 0;
+        int shift = WHEEL_ROOT_BITS + WHEEL_LEVEL_BITS;
+        while (level < WHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << shift))
+        {
+            level ++ ;
+            shift += WHEEL_LEVEL_BITS;
+        }
+        // 超出最高层一圈的按最远处理
+        if (delta >= ((uint64_t)1 << shift)) expire = current + ((uint64_t)1 << shift) - 1;
+        head = &levels[level][(expire >> (shift - WHEEL_LEVEL_BITS)) & (WHEEL_LEVEL_SIZE - 1)];
+    }
+
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+void timerWheel::unlink(utilTimer *timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = timer->next = NULL;
+}
+
+// 把第level层当前槽里的定时器按current重新分散到低层，返回该槽的下标
+int timerWheel::cascade(int level)
+{
+    int index = (current >> (WHEEL_ROOT_BITS + level * WHEEL_LEVEL_BITS)) & (WHEEL_LEVEL_SIZE - 1);
+    utilTimer *head = &levels[level][index];
+    utilTimer *tmp = head->next;
+    head->prev = head->next = head;
+    while (tmp != head)
+    {
+        utilTimer *next = tmp->next;
+        place(tmp);
+        tmp = next;
+    }
+    return index;
+}
+
+void timerWheel::addTimer(utilTimer *timer)
+{
+    if (!timer)
+    {
+        return;
+    }
+    if (timer->next)
+    {
+        adjustTimer(timer);
+        return;
+    }
+    place(timer);
+    count ++ ;
+}
+
+void timerWheel::adjustTimer(utilTimer *timer)
+{
+    if (!timer || !timer->next)
+    {
+        return;
+    }
+    unlink(timer);
+    place(timer);
+}
+
+void timerWheel::deleteTimer(utilTimer *timer)
+{
+    if (!timer || !timer->next)
+    {
+        return;
+    }
+    unlink(timer);
+    count -- ;
+}
+
+// 逐毫秒推进到当前时间，依次处理到期的槽，当前时间取反应堆本轮循环开始时更新的共享时钟
+// 回调前先把定时器从轮上摘下并清掉userData->timer，回调里可以直接关闭连接
+void timerWheel::tick()
+{
+    uint64_t now = coarseClock::nowMs();
+    while (current <= now)
+    {
+        if (count == 0)
+        {
+            current = now + 1;
+            break;
+        }
+
+        int index = current & (WHEEL_ROOT_SIZE - 1);
+        // 第一层转完一圈，依次从上面各层把定时器分散下来
+        if (index == 0)
+        {
+            for (int level = 0; level < WHEEL_LEVELS && cascade(level) == 0; level ++ );
+        }
+        current ++ ;
+
+        utilTimer *head = &root[index];
+        while (head->next != head)
+        {
+            utilTimer *tmp = head->next;
+            unlink(tmp);
+            count -- ;
+            if (tmp->userData) tmp->userData->timer = NULL;
+            tmp->callBack(tmp->userData);
+        }
+    }
+}
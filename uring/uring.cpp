@@ -0,0 +1,277 @@
+#include <stdlib.h>
+#include "uring.h"
+
+ioUring::ioUring()
+{
+    ringFd = -1;
+    sqRing = cqRing = MAP_FAILED;
+    sqes = (io_uring_sqe*)MAP_FAILED;
+    sqLocalTail = sqSubmitted = 0;
+    bufRing = (io_uring_buf_ring*)MAP_FAILED;
+    bufBase = NULL;
+    bufCount = 0;
+}
+
+ioUring::~ioUring()
+{
+    if (bufRing != MAP_FAILED) munmap(bufRing, bufRingSize);
+    delete[] bufBase;
+    if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+    if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+    if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+    if (ringFd != -1) close(ringFd);
+}
+
+// 创建环并映射提交队列、完成队列和SQE数组
+bool ioUring::init(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ringFd < 0) return false;
+
+    sqEntries = params.sq_entries;
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    // 新内核上SQ和CQ共用一次映射
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (cqRingSize > sqRingSize) sqRingSize = cqRingSize;
+        cqRingSize = sqRingSize;
+    }
+
+    sqRing = mmap(0, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) return false;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) cqRing = sqRing;
+    else
+    {
+        cqRing = mmap(0, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) return false;
+    }
+
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe*)mmap(0, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return false;
+
+    char* sq = (char*)sqRing;
+    sqHead = (unsigned*)(sq + params.sq_off.head);
+    sqTail = (unsigned*)(sq + params.sq_off.tail);
+    sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    sqArray = (unsigned*)(sq + params.sq_off.array);
+    sqLocalTail = sqSubmitted = *sqTail;
+
+    char* cq = (char*)cqRing;
+    cqHead = (unsigned*)(cq + params.cq_off.head);
+    cqTail = (unsigned*)(cq + params.cq_off.tail);
+    cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+// 注册count块大小为size的缓冲区，多发recv从这组缓冲区里取
+bool ioUring::initBufRing(int group, int count, int size)
+{
+    bufGroup = group;
+    bufCount = count;
+    bufSize = size;
+    bufRingSize = count * sizeof(io_uring_buf);
+    bufRing = (io_uring_buf_ring*)mmap(0, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufRing == MAP_FAILED) return false;
+    bufBase = new char[(size_t)count * size];
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)bufRing;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return false;
+
+    bufRing->tail = 0;
+    for (int i = 0; i < count; i ++ ) recycleBuffer(i);
+    return true;
+}
+
+// 等一个完成事件，取出结果后归还
+static bool waitOne(ioUring* ring, int& res, unsigned& flags)
+{
+    if (ring->submit(1) < 0) return false;
+    io_uring_cqe* cqe = ring->peekCqe();
+    if (!cqe) return false;
+    res = cqe->res;
+    flags = cqe->flags;
+    ring->seenCqe();
+    return true;
+}
+
+// io_uring_setup成功不代表内核够新：缓冲区环、多发accept、多发recv分别需要更高的版本
+// 先查操作码表，再在回环连接上真正做一次多发accept和多发recv，不支持的内核会返回-EINVAL
+bool ioUring::probe()
+{
+    static const int ops[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_READ, IORING_OP_TIMEOUT};
+    size_t probeSize = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    io_uring_probe* p = (io_uring_probe*)calloc(1, probeSize);
+    bool ok = syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, p, 256) >= 0;
+    for (size_t i = 0; ok && i < sizeof(ops) / sizeof(ops[0]); i ++ )
+    {
+        ok = ops[i] <= p->last_op && (p->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(p);
+    if (!ok) return false;
+
+    int listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int clientFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int connFd = -1;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ok = listenFd >= 0 && clientFd >= 0
+         && bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) == 0
+         && listen(listenFd, 1) == 0
+         && getsockname(listenFd, (struct sockaddr*)&addr, &len) == 0
+         && connect(clientFd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+
+    int res = 0;
+    unsigned flags = 0;
+    if (ok)
+    {
+        ok = prepAcceptMultishot(listenFd, 1)
+             && waitOne(this, res, flags) && res >= 0 && (flags & IORING_CQE_F_MORE);
+        if (res >= 0) connFd = res;
+    }
+    if (ok)
+    {
+        ok = prepRecvMultishot(connFd, 2)
+             && send(clientFd, "x", 1, MSG_NOSIGNAL) == 1
+             && waitOne(this, res, flags) && res == 1
+             && (flags & IORING_CQE_F_BUFFER) && (flags & IORING_CQE_F_MORE);
+        if (res > 0 && (flags & IORING_CQE_F_BUFFER)) recycleBuffer(flags >> IORING_CQE_BUFFER_SHIFT);
+    }
+
+    if (connFd >= 0) close(connFd);
+    if (clientFd >= 0) close(clientFd);
+    if (listenFd >= 0) close(listenFd);
+    return ok;
+}
+
+// 把一块缓冲区还给内核
+// 不能用bufRing->bufs：内核头文件里的柔性数组在C++下会偏移8字节，直接按io_uring_buf数组访问
+void ioUring::recycleBuffer(int bid)
+{
+    unsigned short tail = bufRing->tail;
+    io_uring_buf* buf = (io_uring_buf*)bufRing + (tail & (bufCount - 1));
+    buf->addr = (uint64_t)buffer(bid);
+    buf->len = bufSize;
+    buf->bid = bid;
+    __atomic_store_n(&bufRing->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+// 取一个空闲的SQE，提交队列满时先提交一次
+io_uring_sqe* ioUring::getSqe()
+{
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (sqLocalTail - head >= sqEntries)
+    {
+        submit(0);
+        head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (sqLocalTail - head >= sqEntries) return NULL;
+    }
+
+    unsigned index = sqLocalTail & *sqMask;
+    io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    sqLocalTail ++ ;
+    return sqe;
+}
+
+// 一次系统调用提交所有积攒的SQE，并等待至少waitNr个完成事件
+// 只把内核实际取走的SQE记为已提交，出错时没取走的留在队列里，下次一起提交
+int ioUring::submit(unsigned waitNr)
+{
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    unsigned toSubmit = sqLocalTail - sqSubmitted;
+    if (toSubmit == 0 && waitNr == 0) return 0;
+
+    unsigned flags = waitNr ? IORING_ENTER_GETEVENTS : 0;
+    int ret = syscall(__NR_io_uring_enter, ringFd, toSubmit, waitNr, flags, NULL, 0);
+    if (ret > 0) sqSubmitted += ret;
+    return ret;
+}
+
+// 取下一个完成事件，没有则返回NULL
+io_uring_cqe* ioUring::peekCqe()
+{
+    unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) return NULL;
+    return &cqes[head & *cqMask];
+}
+
+// 处理完一个完成事件后归还给内核
+void ioUring::seenCqe()
+{
+    __atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE);
+}
+
+bool ioUring::prepAcceptMultishot(int fd, uint64_t userData)
+{
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool ioUring::prepRecvMultishot(int fd, uint64_t userData)
+{
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bufGroup;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool ioUring::prepSendmsg(int fd, const msghdr* msg, uint64_t userData)
+{
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool ioUring::prepRead(int fd, void* buf, unsigned len, uint64_t userData)
+{
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = len;
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool ioUring::prepTimeout(__kernel_timespec* ts, uint64_t userData)
+{
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uint64_t)ts;
+    sqe->len = 1;
+    sqe->user_data = userData;
+    return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include "../lock/locker.h"
+
+// 直接基于系统调用的io_uring封装，不依赖liburing
+// 只实现服务器需要的部分：提交队列、完成队列和一个提供给多发recv用的缓冲区环
+class ioUring
+{
+    private:
+        int                 ringFd;
+        unsigned            sqEntries;
+        unsigned*           sqHead;
+        unsigned*           sqTail;
+        unsigned*           sqMask;
+        unsigned*           sqArray;
+        unsigned            sqLocalTail;        // 尚未发布给内核的队尾
+        unsigned            sqSubmitted;        // 内核已经取走的队尾
+        io_uring_sqe*       sqes;
+        unsigned*           cqHead;
+        unsigned*           cqTail;
+        unsigned*           cqMask;
+        io_uring_cqe*       cqes;
+        void*               sqRing;
+        void*               cqRing;
+        size_t              sqRingSize;
+        size_t              cqRingSize;
+        size_t              sqesSize;
+
+        // 提供给内核的缓冲区环，recv时由内核从中挑一块，块数必须是2的幂
+        io_uring_buf_ring*  bufRing;
+        char*               bufBase;
+        int                 bufCount;
+        int                 bufSize;
+        int                 bufGroup;
+        size_t              bufRingSize;
+
+    public:
+        ioUring();
+        ~ioUring();
+
+        bool            init(unsigned entries);
+        bool            initBufRing(int group, int count, int size);
+        // 在已经init和initBufRing的环上确认服务器用到的操作码、多发accept和多发recv都可用
+        bool            probe();
+        io_uring_sqe*   getSqe();
+        int             submit(unsigned waitNr);
+
+        io_uring_cqe*   peekCqe();
+        void            seenCqe();
+
+        char*           buffer(int bid) { return bufBase + (size_t)bid * bufSize; }
+        void            recycleBuffer(int bid);
+        int             getBufGroup() { return bufGroup; }
+
+        // 提交队列满且提交失败、拿不到SQE时返回false，调用者关闭连接或下一轮重试
+        bool            prepAcceptMultishot(int fd, uint64_t userData);
+        bool            prepRecvMultishot(int fd, uint64_t userData);
+        bool            prepSendmsg(int fd, const msghdr* msg, uint64_t userData);
+        bool            prepRead(int fd, void* buf, unsigned len, uint64_t userData);
+        bool            prepTimeout(__kernel_timespec* ts, uint64_t userData);
+};